@@ -3,10 +3,24 @@
 #include <unordered_map>
 #include <queue>
 #include <omp.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <memory>
+#include <cassert>
 // #include <chrono>   
 // using namespace chrono;
 using namespace std;
 
+// 概率以对数的定点数表示：LogProb(p) = round(ln(p) * LOG_PROB_SCALE)
+// 一个PT的概率是各项概率之积，取对数之后就是各项之和。整数加减没有舍入误差，与计算顺序无关，
+// 所以由父PT加减一项得到的子PT概率，与从头累加得到的值完全相同；连乘很多个小概率时也不会像float那样下溢
+#define LOG_PROB_SCALE 4294967296.0
+inline long long LogProb(double p)
+{
+    return llround(log(p) * LOG_PROB_SCALE);
+}
+
 class segment
 {
 public:
@@ -30,6 +44,9 @@ public:
     // total_freq作为分母，用于计算每个value的概率
     int total_freq = 0;
 
+    // log_probs[i]: ordered_values[i]的概率的对数，即LogProb(ordered_freqs[i] / total_freq)，在order()中算出
+    vector<long long> log_probs;
+
     // 未排序的value，其中int就是对应的id
     unordered_map<string, int> values;
 
@@ -42,28 +59,86 @@ public:
     void PrintValues();
 };
 
+// 一个PT最多包含的segment数目。训练时segment更多的口令直接跳过，这样的口令极少，对应的PT概率也极低
+#define PT_MAX_SEGMENTS 16
+
+// 容量固定为N、元素直接存放在对象内部的数组，用法和vector相同
+// 不在堆上分配内存，T可以直接复制时整个数组也可以直接复制（memcpy）
+// 超出容量是调用者的错误（例如训练时没有跳过segment过多的口令），用assert检查
+template <class T, int N>
+class FixedVector
+{
+public:
+    void emplace_back(const T &value)
+    {
+        assert(count < N);
+        items[count] = value;
+        count += 1;
+    }
+    size_t size() const { return count; }
+    T &operator[](size_t i)
+    {
+        assert(i < (size_t)N);
+        return items[i];
+    }
+    const T &operator[](size_t i) const
+    {
+        assert(i < (size_t)N);
+        return items[i];
+    }
+    T *begin() { return items; }
+    T *end() { return items + count; }
+    const T *begin() const { return items; }
+    const T *end() const { return items + count; }
+
+private:
+    T items[N];
+    int count = 0;
+};
+
+// PT中的一个segment只需要类型和长度，模型中的统计数据通过model::GetSegment直接找到
+struct PTSegment
+{
+    short type;
+    short length;
+    void PrintSeg() const;
+};
+
 class PT
 {
 public:
     // 例如，L6D1的content大小为2，content[0]为L6，content[1]为D1
-    vector<segment> content;
+    // PT的所有成员都存放在对象内部，复制一个PT就是复制240个字节（sizeof(PT)），不需要分配内存
+    FixedVector<PTSegment, PT_MAX_SEGMENTS> content;
 
     // pivot值，参见PCFG的原理
     int pivot = 0;
-    void insert(segment seg);
+    void insert(int type, int length);
     void PrintPT();
 
     // 导出新的PT
     vector<PT> NewPTs();
 
     // 记录当前每个segment（除了最后一个）对应的value，在模型中的下标
-    vector<int> curr_indices;
+    FixedVector<int, PT_MAX_SEGMENTS> curr_indices;
 
     // 记录当前每个segment（除了最后一个）对应的value，在模型中的最大下标（即最大可以是max_indices[x]-1）
-    vector<int> max_indices;
+    FixedVector<int, PT_MAX_SEGMENTS> max_indices;
     // void init();
+    // PT本身的概率，只在model::order()中用来给ordered_pts排序；生成猜测时使用preterm_log_prob
     float preterm_prob;
-    float prob;
+    long long preterm_log_prob;
+    // 概率的对数（见LogProb），优先队列按它排序
+    long long log_prob;
+
+    // 这个PT在model::preterminals中的下标，在model::order()中确定
+    int model_index = -1;
+
+    // 最后一个segment已经生成到的下标。猜测分多次生成时（见PriorityQueue::chunk_size），下一次从这里继续
+    int last_begin = 0;
+
+    // 还没有生成的猜测数目
+    int Remaining() const { return max_indices[content.size() - 1] - last_begin; }
 };
 
 class model
@@ -71,49 +146,38 @@ class model
 public:
     // 对于PT/LDS而言，序号是递增的
     // 训练时每遇到一个新的PT/LDS，就获取一个新的序号，并且当前序号递增1
+    // segment不需要序号，直接按类型和长度索引，见下面的segments
     int preterm_id = -1;
-    int letters_id = -1;
-    int digits_id = -1;
-    int symbols_id = -1;
     int GetNextPretermID()
     {
         preterm_id++;
         return preterm_id;
     };
-    int GetNextLettersID()
-    {
-        letters_id++;
-        return letters_id;
-    };
-    int GetNextDigitsID()
-    {
-        digits_id++;
-        return digits_id;
-    };
-    int GetNextSymbolsID()
-    {
-        symbols_id++;
-        return symbols_id;
-    };
 
     // C++上机和数据结构实验中，一般不允许使用stl
     // 这就导致大家对stl不甚熟悉。现在是时候体会stl的便捷之处了
     // unordered_map: 无序映射
     int total_preterm = 0;
     vector<PT> preterminals;
-    int FindPT(PT pt);
+    int FindPT(const PT &pt);
 
-    vector<segment> letters;
-    vector<segment> digits;
-    vector<segment> symbols;
-    int FindLetter(segment seg);
-    int FindDigit(segment seg);
-    int FindSymbol(segment seg);
+    // 按[type][length]直接索引的segment统计数据：segments[1]、segments[2]、segments[3]分别对应字母、数字、特殊字符，
+    // segments[type][length]就是长度为length的segment，例如segments[1][6]就是L6。segments[0]不使用
+    // 训练时遇到更长的segment才扩大表格，所以表格的大小不超过最长口令的长度
+    vector<segment> segments[4];
+    // segment_freq[type][length]：这个segment在训练集中出现的次数，为0表示没有出现过
+    vector<int> segment_freq[4];
+
+    // 一个segment在模型中对应的统计数据，训练和生成猜测时都是O(1)的
+    segment &GetSegment(const PTSegment &seg)
+    {
+        return segments[seg.type][seg.length];
+    }
+
+    // 训练时把一个segment的value计入统计，并把这个segment加入pt。之后value会被清空
+    void AddSegment(PT &pt, int type, string &value);
 
     unordered_map<int, int> preterm_freq;
-    unordered_map<int, int> letters_freq;
-    unordered_map<int, int> digits_freq;
-    unordered_map<int, int> symbols_freq;
 
     vector<PT> ordered_pts;
 
@@ -129,19 +193,205 @@ public:
     // 对一个给定的口令进行切分
     void parse(string pw);
 
+    // 训练时因为segment数超过PT_MAX_SEGMENTS而跳过的口令数
+    int skipped_passwords = 0;
+
     void order();
 
+    // 模型的指纹：所有PT、所有segment的value及其频数的64位FNV-1a哈希，在order()的最后算出
+    // 检查点只能在指纹相同的模型上恢复，见GuessStream::Restore
+    uint64_t fingerprint = 0;
+
     // 打印模型
     void print();
 };
 
+// 元素默认初始化（而不是值初始化）的分配器：vector<char>在resize时不再把新增的部分清零
+// GuessBuffer::reserve扩大缓冲区之后，fill会写入每一个字节，事先清零只是多遍历一遍内存
+template <class T>
+struct DefaultInitAllocator : allocator<T>
+{
+    template <class U>
+    struct rebind
+    {
+        using other = DefaultInitAllocator<U>;
+    };
+
+    DefaultInitAllocator() = default;
+    template <class U>
+    DefaultInitAllocator(const DefaultInitAllocator<U> &) {}
+
+    template <class U>
+    void construct(U *p) { ::new ((void *)p) U; }
+    template <class U, class... Args>
+    void construct(U *p, Args &&...args) { ::new ((void *)p) U(std::forward<Args>(args)...); }
+};
+
+// 连续存放的口令猜测
+// 所有猜测的字符依次存放在同一块内存中，第i个猜测是bytes中[offsets[i], offsets[i + 1])的部分，
+// 每个猜测只占它本身的字节数加上一个下标，不需要为每个猜测单独分配内存
+// clear()之后内存仍然保留，下一批猜测直接复用
+class GuessBuffer
+{
+public:
+    GuessBuffer() : offsets(1, 0) {}
+
+    // 一次追加n个猜测，第i个猜测为prefix后面接上values[i]
+    // 先算出每个猜测的位置，再由多个线程各自写入互不重叠的一段，不需要加锁
+    void append(const string &prefix, const string values[], size_t n)
+    {
+        fill(reserve(prefix.size(), values, n), prefix, values, n);
+    }
+
+    // append分为两步：reserve为n个猜测预留位置，返回第一个猜测的下标；fill再写入这些猜测的内容
+    // 批量生成时先依次为多个PT预留位置，再由多个线程同时写入各自的部分（见PriorityQueue::PopBatch）
+    size_t reserve(size_t prefix_len, const string values[], size_t n);
+    void fill(size_t first, const string &prefix, const string values[], size_t n);
+
+    void clear()
+    {
+        bytes.clear();
+        offsets.resize(1);
+    }
+
+    size_t size() const { return offsets.size() - 1; }
+    bool empty() const { return offsets.size() == 1; }
+
+    // 第i个猜测的副本，用于输出等不在乎性能的地方
+    string operator[](size_t i) const { return string(data() + offsets[i], data() + offsets[i + 1]); }
+
+    // 直接交给哈希函数的缓冲区及下标，见md5.h中的MD5Hash
+    const char *data() const { return bytes.data(); }
+    const size_t *index() const { return offsets.data(); }
+
+private:
+    // resize时不清零，见DefaultInitAllocator
+    vector<char, DefaultInitAllocator<char>> bytes;
+    vector<size_t> offsets;
+};
+
+// 一个PT生成的一组猜测，不展开成字符串：第i个猜测是prefix后面接上values[i]，共n个
+// values指向模型中最后一个segment的ordered_values，长度都相同，可以直接交给MD5HashSuffixes
+struct GuessRun
+{
+    string prefix;
+    const string *values;
+    size_t n;
+};
+
+// 按照概率降序弹出PT的二叉堆
+// PT本身存放在pool中，堆里只存放轻量的句柄（概率、入队序号、PT在pool中的位置），
+// 上浮、下沉时只移动句柄，不需要移动PT。入队和出队都是O(log n)的
+// 概率相同的PT，先入队的先出队
+//
+// 内存中的PT超过memory_limit个时，概率较低的一半按出队顺序写入一个临时文件（一个“run”），
+// 内存中只保留概率较高的一半。每个run记下自己的第一个PT，出队时如果某个run的第一个PT比内存中的队首优先，
+// 就先从这个run读入一段。这样出队的顺序与全部放在内存中时完全相同，而内存中的PT数目基本不超过memory_limit
+class PTQueue
+{
+public:
+    PTQueue() = default;
+    // 临时文件不能被复制
+    PTQueue(const PTQueue &) = delete;
+    PTQueue &operator=(const PTQueue &) = delete;
+    ~PTQueue();
+
+    void push(const PT &pt);
+
+    // 一次加入多个PT，加入的PT较多时直接重新建堆
+    void push(const vector<PT> &pts);
+
+    // 概率最大的PT。在下一次push或pop之前有效
+    PT &top();
+    void pop();
+
+    bool empty() const { return heap.empty() && runs.empty(); }
+    size_t size() const;
+
+    // 把队列的状态连同入队序号写入file，成功时返回true
+    // 内存中的PT直接写入；有名字的run（见spill_prefix）写入之后不再改变，只记下文件名和读到的位置，
+    // 所以保存的数据量不超过memory_limit个PT，与写入文件的PT数目无关。匿名的run只能把没有读入的PT整个复制一份
+    bool save(FILE *file);
+    // 用save写入的内容替换整个队列，之后出队的顺序与保存时完全相同
+    // 失败时返回false并在error中给出原因。文件损坏、run文件缺失时队列不变；
+    // 检查通过之后读取仍然出错（I/O错误）时队列已经被部分替换，这时清空队列
+    bool load(FILE *file, string &error);
+    // 删除已经读完、只有上一个检查点还会用到的run文件。新的检查点成功写入之后调用
+    void prune();
+    // 删除所有以spill_prefix开头、队列没有引用的run文件，例如程序被杀掉时上一个检查点之后才写入的run。
+    // 从检查点恢复之后调用；同一个spill_prefix不能同时被另一个进程使用
+    void sweep();
+
+    // 内存中最多保留的PT数目，0表示不限制
+    // 临时文件创建、写入或读回失败（例如磁盘已满）时，push、top、pop抛出runtime_error，不会丢掉任何PT
+    size_t memory_limit = 0;
+
+    // 为空时run写入tmpfile()；否则写入以spill_prefix开头的文件（后接mkstemp生成的6个字符），检查点只需要记下文件名
+    // 这些文件由检查点引用，程序退出时不会删除：没有被任何检查点保存过的run在读完或程序退出时删除，
+    // 保存过的run读完之后要等下一个检查点写入（prune）才删除。程序被杀掉时留在磁盘上的其余run在恢复时删除（sweep）
+    string spill_prefix;
+
+private:
+    struct Handle
+    {
+        long long log_prob;
+        size_t seq;
+        int slot;
+    };
+    // std::push_heap等建立的是大根堆，这里的“小于”表示优先级更低
+    static bool Lower(const Handle &a, const Handle &b)
+    {
+        return a.log_prob < b.log_prob || (a.log_prob == b.log_prob && a.seq > b.seq);
+    }
+    // 把PT放入pool，返回它的句柄（还没有放入堆中）
+    Handle place(const PT &pt, size_t seq);
+
+    // 写入临时文件的一个PT，连同它的入队序号，读回来之后在堆中的位置不变
+    struct SpillRecord
+    {
+        PT pt;
+        size_t seq;
+    };
+    // 一个临时文件，其中的PT按出队顺序排列。head是下一个要出队的PT，left是文件中head之后还没有读入的PT数目
+    // name为空表示tmpfile()创建的匿名文件；saved表示这个run已经被某个检查点引用
+    struct SpillRun
+    {
+        FILE *file;
+        SpillRecord head;
+        size_t left;
+        string name;
+        bool saved;
+    };
+    static Handle Key(const SpillRecord &record) { return {record.pt.log_prob, record.seq, -1}; }
+
+    // 把概率较低的一半PT写入一个新的run
+    void spill();
+    // 从第r个run读入一段PT放入堆中
+    void load(int r);
+    // 关闭一个run，没有被检查点引用的文件直接删除，否则留到prune
+    void close(SpillRun &run);
+    // 关闭所有run，清空队列
+    void clear();
+    // 保证堆顶就是所有PT中最优先的：有run的head比堆顶优先时，先读入这个run
+    void settle();
+
+    vector<Handle> heap;
+    vector<PT> pool;
+    // 已经出队的PT在pool中留下的空位，之后入队的PT优先放在这里
+    vector<int> free_slots;
+    size_t next_seq = 0;
+    vector<SpillRun> runs;
+    // 已经读完、但上一个检查点还引用着的run文件
+    vector<string> retired;
+};
+
 // 优先队列，用于按照概率降序生成口令猜测
 // 实际上，这个class负责队列维护、口令生成、结果存储的全部过程
 class PriorityQueue
 {
 public:
-    // 用vector实现的priority queue
-    vector<PT> priority;
+    // 按概率降序排列的PT
+    PTQueue priority;
 
     // 模型作为成员，辅助猜测生成
     model m;
@@ -149,14 +399,132 @@ public:
     // 计算一个pt的概率
     void CalProb(PT &pt);
 
+    // 由父PT的概率计算NewPTs生成的一个子PT的概率。子PT只有第pivot个segment的下标比父PT大1，
+    // 所以只需要减去旧value的对数概率，再加上新value的，是O(1)的
+    void UpdateProb(const PT &parent, PT &child);
+
     // 优先队列的初始化
     void init();
 
+    // 给model::ordered_pts中的一个PT填上各segment的value数目和概率，init对每个PT调用一次
+    void InitPT(PT &pt);
+
     // 对优先队列的一个PT，生成所有guesses
     void Generate(PT pt);
 
+    // 给PT中除最后一个segment以外的所有segment赋予实际的值，拼成前缀写入prefix，
+    // 返回最后一个segment在模型中的统计数据。只读取模型，可以在多个线程中同时调用
+    segment *Instantiate(const PT &pt, string &prefix);
+
     // 将优先队列最前面的一个PT
     void PopNext();
-    int total_guesses = 0;
-    vector<string> guesses;
-};
\ No newline at end of file
+
+    // 批量出队：一次取出最多batch_size个PT，多个线程同时生成它们的猜测和子PT，子PT最后一起放回队列
+    // 只有概率不低于队首概率(1 - max_deviation)倍的PT才会进入同一批。同一批中某个PT的子PT可能比
+    // 这一批后面的PT概率更高，却要等这一批结束才出队，但这样提前生成的猜测的概率至多比它应有的位置低max_deviation的比例
+    // batch_size为1或max_deviation为0时，与反复调用PopNext的顺序完全相同
+    void PopBatch();
+    int batch_size = 1;
+    float max_deviation = 0;
+
+    // 一次出队最多生成chunk_size个猜测，0表示不限制
+    // 最后一个segment的value更多的PT分多次生成：在生成完之前它一直留在队首（概率不变），每次生成一段，
+    // 最后一段生成完才出队并放入子PT。因此生成的顺序与不分段时完全相同，而一次生成的猜测数目不再取决于模型中最大的segment
+    int chunk_size = 0;
+
+    // 长时间运行（例如从检查点多次继续）时会超过2^31，用64位计数
+    long long total_guesses = 0;
+    GuessBuffer guesses;
+
+    // 为true时，Generate和PopBatch不把猜测写入guesses，而是把每个PT的前缀和最后一个segment的value
+    // 记入lazy_runs，由使用者直接哈希（见md5.h中的MD5HashSuffixes），省去拼接和复制猜测的开销
+    // total_guesses仍然照常累加。清空时只需清空lazy_runs
+    bool lazy = false;
+    vector<GuessRun> lazy_runs;
+};
+/**
+ * GuessStream: 按概率降序、由使用者按需拉取猜测的流
+ * 使用者每次调用NextBatch取下一批猜测，处理完再取下一批，生成的速度自然跟随使用者的速度，
+ * 不需要在使用者那里维护猜测缓冲区、已生成总数和清空的时机
+ * 用法：
+ *     GuessStream stream(q, 10000000);
+ *     vector<GuessRun> runs;
+ *     while (stream.NextBatch(runs, 100000) > 0) { 处理runs; runs.clear(); }
+ * 队列q需要已经init，batch_size、max_deviation、chunk_size等设置照常生效
+ * 构造时把q.lazy设为true并且不再恢复：猜测始终以GuessRun的形式生成，由调用者决定是否展开。
+ * 之后q只应通过这个GuessStream使用，直接调用q.PopBatch得到的猜测在q.lazy_runs中，而不在q.guesses中
+ */
+class GuessStream
+{
+public:
+    // limit: 最多生成的猜测数，0表示一直生成到队列为空
+    GuessStream(PriorityQueue &q, uint64_t limit = 0) : q(q), limit(limit) { q.lazy = true; }
+
+    // 生成下一批猜测，追加到runs中，返回这一批的猜测数，0表示已经结束
+    // 一批至少有n个猜测（队列耗尽或达到limit时除外），多出的部分不超过一次PopBatch生成的数目
+    size_t NextBatch(vector<GuessRun> &runs, size_t n);
+
+    // 同上，但把猜测展开，追加到guesses中
+    size_t NextBatch(GuessBuffer &guesses, size_t n);
+
+    // 到目前为止生成的猜测总数
+    uint64_t generated() const { return total; }
+    bool done() const { return q.priority.empty() || (limit > 0 && total >= limit); }
+
+    // 检查点：保存当前的生成状态（队列，见PTQueue::save；已生成的猜测数、模型指纹），成功时返回true
+    // 先写入path.tmp再改名，写到一半被杀掉时原来的检查点仍然完整
+    bool Save(const string &path);
+    // 从检查点恢复，之后生成的猜测与保存时接着生成的完全相同
+    // 成功时删除spill_prefix下检查点没有引用的run文件（见PTQueue::sweep）
+    // 失败时返回false：文件不存在时error为空，损坏、模型指纹不同或引用的run文件缺失时error给出原因，状态不变；
+    // 读取出错时error同样给出原因，队列被清空（见PTQueue::load）
+    bool Restore(const string &path, string &error);
+
+private:
+    PriorityQueue &q;
+    uint64_t limit;
+    uint64_t total = 0;
+};
+
+/**
+ * GuessBand: 给出概率落在[p_lo, p_hi)之内的全部猜测，不需要优先队列
+ * 一个猜测的概率是它的PT中各个segment的value的对数概率之和（与PriorityQueue排序用的log_prob相同）
+ * 从model::ordered_pts出发，按PT::NewPTs的pivot规则遍历所有PT（每个PT恰好被遍历一次），
+ * 一个PT的log_prob是它的猜测中最大的概率，而NewPTs生成的子PT的概率不会更大，
+ * 所以log_prob低于p_lo的PT连同它的所有后代都可以直接剪掉。
+ * 最后一个segment的value按概率降序排列，一个PT落在区间内的猜测是连续的一段，用二分查找确定
+ *
+ * 把概率切成互不相交的若干段，每个线程或节点各取一段，彼此之间没有共享的队列；
+ * 所有段合起来与PriorityQueue按顺序生成、概率不低于最低一段下界的猜测完全相同，每个猜测恰好出现一次。
+ * 但同一段内的猜测按遍历的顺序给出，并不按概率排序
+ * 用法（q只需要train和order，不需要init；多个GuessBand可以在不同的线程中共用同一个q）：
+ *     GuessBand band(q, 1e-9, 1e-7);
+ *     vector<GuessRun> runs;
+ *     while (band.NextBatch(runs, 100000) > 0) { 处理runs; runs.clear(); }
+ */
+class GuessBand
+{
+public:
+    // p_hi >= 1表示没有上界。p_lo必须大于0，否则抛出invalid_argument：
+    // 遍历时栈中保存所有还没有访问的、概率不低于p_lo的PT，没有下界时PT的数目（以及占用的内存）没有上限，
+    // 所以划分给各个worker时，最后一段也要取一个有限的下界，更低的部分留给之后再划分
+    GuessBand(PriorityQueue &q, double p_lo, double p_hi);
+
+    // 生成下一批猜测，追加到runs中，返回这一批的猜测数，0表示这一段已经全部生成
+    // 一批至少有n个猜测（生成完毕时除外），多出的部分不超过一个PT的猜测数
+    size_t NextBatch(vector<GuessRun> &runs, size_t n);
+
+    uint64_t generated() const { return total; }
+    bool done() const { return stack.empty() && next_root == q.m.ordered_pts.size(); }
+
+private:
+    PriorityQueue &q;
+    // 区间两端的对数概率（见LogProb）
+    long long lo;
+    long long hi;
+    // 深度优先遍历时还没有处理的PT
+    vector<PT> stack;
+    // 下一个要加入遍历的model::ordered_pts的下标
+    size_t next_root = 0;
+    uint64_t total = 0;
+};
@@ -3,19 +3,122 @@
 #include <fstream>
 #include "md5.h"
 #include <iomanip>
+#include <sstream>
+#include <algorithm>
 using namespace std;
 using namespace chrono;
 
 // 编译指令如下：
-// g++ correctness.cpp train.cpp guessing.cpp md5.cpp -o main
+// g++ correctness.cpp train.cpp guessing.cpp md5.cpp md5_avx2.cpp md5_avx512.cpp -o main
+// 先输出两个长字符串的哈希值，再用标量后端作为基准，检查CPU支持的每个后端的每个入口，全部一致时返回0
 
+// MD5Hash输出的格式：每个字8个十六进制字符
+static string DigestHex(const bit32 state[4])
+{
+	ostringstream out;
+	for (int i1 = 0; i1 < 4; i1 += 1)
+	{
+		out << std::setw(8) << std::setfill('0') << hex << state[i1];
+	}
+	return out.str();
+}
+
+// 固定种子的伪随机字节，每次运行的输入都相同
+static string RandomString(unsigned &seed, size_t length)
+{
+	string s(length, ' ');
+	for (size_t i = 0; i < length; i += 1)
+	{
+		seed = seed * 1103515245 + 12345;
+		s[i] = (char)(33 + (seed >> 16) % 94);
+	}
+	return s;
+}
+
+// 覆盖padding时的各个边界：55字节以内是单block，56～63字节padding多出一个block，64字节刚好一个block，
+// 119/120、127/128是第二个block的同样边界
+static const size_t boundary_lengths[] = {0, 1, 3, 4, 31, 32, 54, 55, 56, 57, 63, 64, 65, 100, 118, 119, 120, 121, 127, 128, 129, 200};
+
+static int checks = 0;
+static int failures = 0;
+
+static void Check(bool ok, const string &backend, const string &what)
+{
+	checks += 1;
+	if (!ok)
+	{
+		failures += 1;
+		cout << "MISMATCH [" << backend << "] " << what << endl;
+	}
+}
+
+// 输入各种长度混在一起、顺序打乱，检查MD5Hash的两个重载（其中多block的消息由MD5Stream计算）
+static void CheckHash(const string &backend, const vector<string> &input, const vector<string> &expected)
+{
+	size_t n = input.size();
+	vector<bit32> state(n * 4);
+	MD5Hash(input.data(), (bit32 (*)[4])state.data(), n);
+	for (size_t i = 0; i < n; i += 1)
+	{
+		Check(DigestHex(&state[i * 4]) == expected[i], backend, "MD5Hash(string) length " + to_string(input[i].size()));
+	}
+
+	GuessBuffer buffer;
+	for (const string &s : input)
+	{
+		buffer.append("", &s, 1);
+	}
+	fill(state.begin(), state.end(), 0);
+	MD5Hash(buffer.data(), buffer.index(), (bit32 (*)[4])state.data(), n);
+	for (size_t i = 0; i < n; i += 1)
+	{
+		Check(DigestHex(&state[i * 4]) == expected[i], backend, "MD5Hash(buffer) length " + to_string(input[i].size()));
+	}
+}
+
+// 检查MD5HashSuffixes：前缀和value的长度组合覆盖单block的各个边界（超过55字节时内部改用MD5Hash）
+static void CheckSuffixes(const string &backend, const vector<string> &prefixes, const vector<vector<string>> &values,
+						  const vector<vector<string>> &expected)
+{
+	for (size_t p = 0; p < prefixes.size(); p += 1)
+	{
+		size_t n = values[p].size();
+		vector<bit32> state(n * 4);
+		MD5HashSuffixes(prefixes[p], values[p].data(), (bit32 (*)[4])state.data(), n);
+		for (size_t i = 0; i < n; i += 1)
+		{
+			Check(DigestHex(&state[i * 4]) == expected[p][i], backend,
+				  "MD5HashSuffixes prefix " + to_string(prefixes[p].size()) + " value " + to_string(values[p][i].size()));
+		}
+	}
+}
+
+// 检查MD5Crack：目标少时走MD5Reverser（倒推最后若干步），目标多时走位图过滤，命中的下标都应与基准相同
+static void CheckCrack(const string &backend, const vector<string> &input, const MD5TargetSet &targets,
+					   const vector<size_t> &expected, const string &what)
+{
+	vector<size_t> hits;
+	MD5Crack(input.data(), input.size(), targets, hits);
+	sort(hits.begin(), hits.end());
+	Check(hits == expected, backend, "MD5Crack(string) " + what);
+
+	GuessBuffer buffer;
+	for (const string &s : input)
+	{
+		buffer.append("", &s, 1);
+	}
+	hits.clear();
+	MD5Crack(buffer.data(), buffer.index(), input.size(), targets, hits);
+	sort(hits.begin(), hits.end());
+	Check(hits == expected, backend, "MD5Crack(buffer) " + what);
+}
 
 // 通过这个函数，你可以验证你实现的SIMD哈希函数的正确性
 int main()
 {
 	bit32 state[2][4];
 	std::string batch[2] = { "bvaisdbjasdkafkasdfnavkjnakdjfejfanjsdnfkajdfkajdfjkwanfdjaknsvjkanbjbjadfajwefajksdfakdnsvjadfasjdvabvaisdbjasdkafkasdfnavkjnakdjfejfanjsdnfkajdfkajdfjkwanfdjaknsvjkanbjbjadfajwefajksdfakdnsvjadfasjdvabvaisdbjasdkafkasdfnavkjnakdjfejfanjsdnfkajdfkajdfjkwanfdjaknsvjkanbjbjadfajwefajksdfakdnsvjadfasjdvabvaisdbjasdkafkasdfnavkjnakdjfejfanjsdnfkajdfkajdfjkwanfdjaknsvjkanbjbjadfajwefajksdfakdnsvjadfasjdva","qqqqsdbjasdkafkasdfnavkjnakdjfejfanjsdnfkajdfkajdfjkwanfdjaknsvjkanbjbjadfajwefajksdfakdnsvjadfasjdvabvaisdbjasdkafkasdfnavkjnakdjfejfanjsdnfkajdfkajdfjkwanfdjaknsvjkanbjbjadfajwefajksdfakdnsvjadfasjdvabvaisdbjasdkafkasdfnavkjnakdjfejfanjsdnfkajdfkajdfjkwanfdjaknsvjkanbjbjadfajwefajksdfakdnsvjadfasjdvabvaisdbjasdkafkasdfnavkjnakdjfejfanjsdnfkajdfkajdfjkwanfdjaknsvjkanbjbjadfajwefajksdfakdnsvjadfasjdva" };
-	MD5Hash(batch, state);
+	MD5Hash(batch, state, 2);
 	for (int i1 = 0; i1 < 4; i1 += 1)
 	{
 		cout << std::setw(8) << std::setfill('0') << hex << state[0][i1];
@@ -25,6 +128,127 @@ int main()
 	{
 		cout << std::setw(8) << std::setfill('0') << hex << state[1][i1];
 	}
-	cout << endl;
-	return 0;
-}
\ No newline at end of file
+	cout << dec << endl;
+
+	// 输入：每个边界长度若干个，再加上随机长度，顺序打乱，保证同一次调用中长短混杂
+	unsigned seed = 12345;
+	vector<string> input;
+	for (size_t length : boundary_lengths)
+	{
+		for (int copy = 0; copy < 5; copy += 1)
+		{
+			input.push_back(RandomString(seed, length));
+		}
+	}
+	for (int i = 0; i < 300; i += 1)
+	{
+		input.push_back(RandomString(seed, seed % 150));
+	}
+	for (size_t i = input.size() - 1; i > 0; i -= 1)
+	{
+		seed = seed * 1103515245 + 12345;
+		swap(input[i], input[(seed >> 8) % (i + 1)]);
+	}
+
+	// MD5HashSuffixes的输入：前缀和value的长度组合，同一组value等长
+	vector<string> prefixes;
+	vector<vector<string>> values;
+	for (size_t prefix_len : {0, 3, 4, 8, 30, 50, 54, 55, 56, 60})
+	{
+		for (size_t value_len : {0, 1, 2, 5, 6, 9, 25})
+		{
+			prefixes.push_back(RandomString(seed, prefix_len));
+			values.emplace_back();
+			for (int i = 0; i < 37; i += 1)
+			{
+				values.back().push_back(RandomString(seed, value_len));
+			}
+		}
+	}
+
+	// 基准：标量后端的结果。它必须先与RFC 1321给出的结果一致
+	if (!MD5UseBackend("scalar"))
+	{
+		cout << "scalar backend unavailable" << endl;
+		return 1;
+	}
+	const string known[][2] = {
+		{"", "d41d8cd98f00b204e9800998ecf8427e"},
+		{"abc", "900150983cd24fb0d6963f7d28e17f72"},
+		{"message digest", "f96b697d7cb7938d525a2f31aaf161d0"},
+		{"12345678901234567890123456789012345678901234567890123456789012345678901234567890", "57edf4a22be3c955ac49da2e2107b67a"},
+	};
+	for (const auto &kv : known)
+	{
+		bit32 digest[4];
+		MD5Hash(&kv[0], (bit32 (*)[4])digest, 1);
+		Check(DigestHex(digest) == kv[1], "scalar", "RFC 1321 \"" + kv[0].substr(0, 16) + "\"");
+	}
+
+	vector<string> expected(input.size());
+	{
+		vector<bit32> ref(input.size() * 4);
+		MD5Hash(input.data(), (bit32 (*)[4])ref.data(), input.size());
+		for (size_t i = 0; i < input.size(); i += 1)
+		{
+			expected[i] = DigestHex(&ref[i * 4]);
+		}
+	}
+	vector<vector<string>> expected_suffixes(prefixes.size());
+	for (size_t p = 0; p < prefixes.size(); p += 1)
+	{
+		vector<string> joined;
+		for (const string &v : values[p])
+		{
+			joined.push_back(prefixes[p] + v);
+		}
+		vector<bit32> ref(joined.size() * 4);
+		MD5Hash(joined.data(), (bit32 (*)[4])ref.data(), joined.size());
+		for (size_t i = 0; i < joined.size(); i += 1)
+		{
+			expected_suffixes[p].push_back(DigestHex(&ref[i * 4]));
+		}
+	}
+
+	// 目标：一个（MD5Reverser）和很多个（位图过滤），另外混入不在输入中的目标
+	MD5TargetSet few, many;
+	vector<size_t> expected_few, expected_many;
+	{
+		vector<bit32> ref(input.size() * 4);
+		MD5Hash(input.data(), (bit32 (*)[4])ref.data(), input.size());
+		few.insert(&ref[7 * 4]);
+		for (size_t i = 0; i < input.size(); i += 3)
+		{
+			many.insert(&ref[i * 4]);
+		}
+		bit32 absent[4] = {0x01234567, 0x89abcdef, 0xdeadbeef, 0x0badf00d};
+		many.insert(absent);
+		for (size_t i = 0; i < input.size(); i += 1)
+		{
+			if (few.contains(&ref[i * 4]))
+			{
+				expected_few.push_back(i);
+			}
+			if (many.contains(&ref[i * 4]))
+			{
+				expected_many.push_back(i);
+			}
+		}
+	}
+
+	for (const char *name : {"scalar", "sse2", "neon", "avx2", "avx512"})
+	{
+		if (!MD5UseBackend(name))
+		{
+			continue;
+		}
+		int before = failures;
+		CheckHash(name, input, expected);
+		CheckSuffixes(name, prefixes, values, expected_suffixes);
+		CheckCrack(name, input, few, expected_few, "1 target");
+		CheckCrack(name, input, many, expected_many, to_string(many.size()) + " targets");
+		cout << "Backend " << name << " (" << MD5Lanes() << " lanes): " << (failures == before ? "OK" : "FAILED") << endl;
+	}
+	cout << checks << " checks, " << failures << " failures" << endl;
+	return failures == 0 ? 0 : 1;
+}
@@ -3,14 +3,13 @@
 #include <fstream>
 #include "md5.h"
 #include <iomanip>
-#include <unordered_set>
 #include <mpi.h> // MPI: 包含 MPI 头文件
 
 using namespace std;
 using namespace chrono;
 
 // MPI 编译指令示例:
-// mpic++ correctness_guess.cpp train.cpp guessing.cpp md5.cpp -o main -O2 
+// mpic++ correctness_guess.cpp train.cpp guessing.cpp md5.cpp md5_avx2.cpp md5_avx512.cpp -o main -O2 
 // mpirun -np 4 ./main
 
 int main(int argc, char* argv[]) // MPI: main 函数签名
@@ -42,17 +41,24 @@ int main(int argc, char* argv[]) // MPI: main 函数签名
     MPI_Barrier(MPI_COMM_WORLD); // 同步点
 
     // --- 2. 加载测试数据 (所有进程都加载一份) ---
-    unordered_set<std::string> test_set;
+    // 测试集只以MD5的形式作为破解目标，猜测是否命中由MD5Crack在SIMD计算之后直接判断
+    vector<string> test_pw;
     ifstream test_data("/guessdata/Rockyou-singleLined-full.txt");
-    int test_count = 0;
     string pw;
     while (test_data >> pw) {
-        test_count += 1;
-        test_set.insert(pw);
-        if (test_count >= 1000000) {
+        test_pw.push_back(pw);
+        if (test_pw.size() >= 1000000) {
             break;
         }
     }
+    MD5TargetSet test_set;
+    {
+        vector<bit32> test_md5(test_pw.size() * 4);
+        MD5Hash(test_pw.data(), (bit32 (*)[4])test_md5.data(), test_pw.size());
+        for (size_t i = 0; i < test_pw.size(); ++i) {
+            test_set.insert(&test_md5[i * 4]);
+        }
+    }
     
     // MPI: 每个进程维护自己的本地破解数
     int local_cracked = 0;
@@ -62,72 +68,45 @@ int main(int argc, char* argv[]) // MPI: main 函数签名
         q.init();
     }
 
-    // MPI: 主进程管理全局计数器和计时器
-    int curr_num = 0;
-    int history = 0;
+    // MPI: 主进程从GuessStream按需拉取猜测，生成总数由GuessStream记录
+    GuessStream stream(q, 10000000);
+    GuessBuffer guesses;
     // 修复方法
     auto start = (rank == 0) ? system_clock::now() : system_clock::time_point{};    bool continue_looping = true;
     
     // --- 4. 并行主循环 ---
     do
     {
-        // 所有进程都调用 PopNext
-        q.PopNext();
-
         // MPI: -------------------------------------------------------------------
         // 所有计时、打印、哈希、破解检查、终止判断的逻辑，都只在主进程(rank 0)中执行
         if (rank == 0)
         {
-            q.total_guesses = q.guesses.size(); // 你的原始逻辑
-            if (q.total_guesses - curr_num >= 100000)
-            {
-                curr_num = q.total_guesses; // 你的原始逻辑
-
-                // 检查终止条件
-                int generate_n = 10000000;
-                if (history + q.total_guesses > generate_n)
-                {
-                    continue_looping = false; // 标记循环结束
-                }
-            }
-            
-            // 检查哈希触发条件
-            if (curr_num > 1000000)
+            // 每次拉取约100万个猜测，哈希之后丢弃
+            guesses.clear();
+            stream.NextBatch(guesses, 1000000);
+            if (!guesses.empty())
             {
                 auto start_hash = system_clock::now();
 
-                // 你的原始并行哈希与破解检查逻辑
-                bit32 batch_states[4][4];
-                size_t total = q.guesses.size();
-                for (size_t i = 0; i < total; i += 4) {
-                    std::string batch[4];
+                // 哈希的同时与目标MD5比对，主进程更新自己的本地破解数
+                const size_t hash_batch = 4096;
+                vector<size_t> hits;
+                size_t total = guesses.size();
+                for (size_t i = 0; i < total; i += hash_batch) {
                     size_t remain = total - i;
-                    size_t batch_size = (remain >= 4) ? 4 : remain;
-
-                    for (size_t j = 0; j < batch_size; ++j) {
-                        if (test_set.find(q.guesses[i + j]) != test_set.end()) {
-                            // 主进程更新自己的本地破解数
-                            local_cracked += 1;
-                        }
-                        batch[j] = q.guesses[i + j];
-                    }
-                    for (size_t j = batch_size; j < 4; ++j) {
-                        batch[j] = "";
-                    }
-                    MD5Hash(batch, batch_states);
+                    size_t batch_size = (remain >= hash_batch) ? hash_batch : remain;
+
+                    hits.clear();
+                    local_cracked += MD5Crack(guesses.data(), guesses.index() + i, batch_size, test_set, hits);
                 }
                 
                 auto end_hash = system_clock::now();
                 auto duration = duration_cast<microseconds>(end_hash - start_hash);
                 time_hash += double(duration.count()) * microseconds::period::num / microseconds::period::den;
-
-                history += curr_num;
-                curr_num = 0;
-                q.guesses.clear();
             }
 
-            // 检查队列是否为空作为另一个终止条件
-            if (q.priority.empty()) {
+            // 达到生成上限或者队列为空时结束
+            if (stream.done()) {
                 continue_looping = false;
             }
         }
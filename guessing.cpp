@@ -1,6 +1,513 @@
 #include "PCFG.h"
+#include <algorithm>
+#include <cstring>
+#include <climits>
+#include <cerrno>
+#include <stdexcept>
+#include <type_traits>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
 using namespace std;
 
+// 猜测数目少于这个值时不值得启动多个线程
+#define PARALLEL_APPEND_MIN 16384
+
+// PTQueue从临时文件中一次读入的PT数目
+#define PT_SPILL_CHUNK 4096
+
+// PT写入临时文件时直接复制内存中的字节
+static_assert(is_trivially_copyable<PT>::value, "PT must be trivially copyable to be spilled to disk");
+
+size_t GuessBuffer::reserve(size_t prefix_len, const string values[], size_t n)
+{
+    // 根据各个value的长度，算出每个猜测结束的位置
+    size_t first = offsets.size() - 1;
+    offsets.resize(first + n + 1);
+    for (size_t i = 0; i < n; i += 1)
+    {
+        offsets[first + i + 1] = offsets[first + i] + prefix_len + values[i].size();
+    }
+    bytes.resize(offsets.back());
+    return first;
+}
+
+void GuessBuffer::fill(size_t first, const string &prefix, const string values[], size_t n)
+{
+    // 每个猜测的位置已经确定，可以按下标把value的范围分给多个线程同时写入
+    char *out = bytes.data();
+    const size_t *pos = offsets.data() + first;
+#pragma omp parallel for schedule(static) if (n >= PARALLEL_APPEND_MIN)
+    for (long i = 0; i < (long)n; i += 1)
+    {
+        memcpy(out + pos[i], prefix.data(), prefix.size());
+        memcpy(out + pos[i] + prefix.size(), values[i].data(), values[i].size());
+    }
+}
+
+PTQueue::Handle PTQueue::place(const PT &pt, size_t seq)
+{
+    int slot;
+    if (free_slots.empty())
+    {
+        slot = pool.size();
+        pool.emplace_back(pt);
+    }
+    else
+    {
+        slot = free_slots.back();
+        free_slots.pop_back();
+        pool[slot] = pt;
+    }
+    return {pt.log_prob, seq, slot};
+}
+
+void PTQueue::push(const PT &pt)
+{
+    heap.push_back(place(pt, next_seq));
+    next_seq += 1;
+    push_heap(heap.begin(), heap.end(), Lower);
+    if (memory_limit > 0 && heap.size() > memory_limit)
+    {
+        spill();
+    }
+}
+
+void PTQueue::push(const vector<PT> &pts)
+{
+    size_t old_size = heap.size();
+    for (const PT &pt : pts)
+    {
+        heap.push_back(place(pt, next_seq));
+        next_seq += 1;
+    }
+    // 重新建堆是O(n)的，逐个上浮是O(k log n)的
+    if (pts.size() * 4 > heap.size())
+    {
+        make_heap(heap.begin(), heap.end(), Lower);
+    }
+    else
+    {
+        for (size_t i = old_size; i < heap.size(); i += 1)
+        {
+            push_heap(heap.begin(), heap.begin() + i + 1, Lower);
+        }
+    }
+    if (memory_limit > 0 && heap.size() > memory_limit)
+    {
+        spill();
+    }
+}
+
+PTQueue::~PTQueue()
+{
+    for (SpillRun &run : runs)
+    {
+        close(run);
+    }
+}
+
+void PTQueue::close(SpillRun &run)
+{
+    fclose(run.file);
+    if (run.name.empty())
+    {
+        return;
+    }
+    if (run.saved)
+    {
+        retired.push_back(run.name);
+    }
+    else
+    {
+        remove(run.name.c_str());
+    }
+}
+
+void PTQueue::prune()
+{
+    for (const string &name : retired)
+    {
+        remove(name.c_str());
+    }
+    retired.clear();
+}
+
+void PTQueue::sweep()
+{
+    if (spill_prefix.empty())
+    {
+        return;
+    }
+    // spill_prefix的目录部分和文件名部分，run文件的名字是文件名部分后接mkstemp生成的6个字符
+    size_t slash = spill_prefix.rfind('/');
+    string dir = slash == string::npos ? "" : spill_prefix.substr(0, slash + 1);
+    string base = spill_prefix.substr(dir.size());
+    DIR *d = opendir(dir.empty() ? "." : dir.c_str());
+    if (d == NULL)
+    {
+        return;
+    }
+    vector<string> orphans;
+    while (dirent *entry = readdir(d))
+    {
+        string name = entry->d_name;
+        if (name.size() != base.size() + 6 || name.compare(0, base.size(), base) != 0)
+        {
+            continue;
+        }
+        // 按文件本身比较：恢复时给出的路径写法（例如相对或绝对路径）可以与保存时不同
+        string path = dir + name;
+        struct stat candidate;
+        if (stat(path.c_str(), &candidate) != 0)
+        {
+            continue;
+        }
+        bool used = false;
+        for (const SpillRun &run : runs)
+        {
+            struct stat open_file;
+            used = used || (fstat(fileno(run.file), &open_file) == 0 && open_file.st_dev == candidate.st_dev &&
+                            open_file.st_ino == candidate.st_ino);
+        }
+        if (!used)
+        {
+            orphans.push_back(path);
+        }
+    }
+    closedir(d);
+    for (const string &path : orphans)
+    {
+        remove(path.c_str());
+    }
+    // 恢复的检查点引用的run都在runs中，已经读完的run也不再需要
+    prune();
+}
+
+void PTQueue::clear()
+{
+    for (SpillRun &run : runs)
+    {
+        close(run);
+    }
+    runs.clear();
+    heap.clear();
+    pool.clear();
+    free_slots.clear();
+}
+
+size_t PTQueue::size() const
+{
+    size_t n = heap.size();
+    for (const SpillRun &run : runs)
+    {
+        n += run.left + 1;
+    }
+    return n;
+}
+
+void PTQueue::spill()
+{
+    // 按优先级从高到低，前keep个留在内存中，其余的排好序写入文件
+    auto higher = [](const Handle &a, const Handle &b) { return Lower(b, a); };
+    size_t keep = heap.size() / 2;
+    nth_element(heap.begin(), heap.begin() + keep, heap.end(), higher);
+    sort(heap.begin() + keep, heap.end(), higher);
+
+    // tmpfile()创建的文件在关闭或程序退出时自动删除；指定了spill_prefix时用mkstemp创建不会与已有文件重名的文件
+    // 创建或写入失败（例如磁盘已满）时直接报错：留在内存中会超出memory_limit，之后每次入队都要再尝试写入
+    SpillRun run;
+    run.saved = false;
+    if (spill_prefix.empty())
+    {
+        run.file = tmpfile();
+    }
+    else
+    {
+        string pattern = spill_prefix + "XXXXXX";
+        int fd = mkstemp(&pattern[0]);
+        run.file = fd >= 0 ? fdopen(fd, "w+b") : NULL;
+        if (fd >= 0 && run.file == NULL)
+        {
+            ::close(fd);
+        }
+        if (fd >= 0)
+        {
+            run.name = pattern;
+        }
+    }
+    bool ok = run.file != NULL;
+    run.head = {pool[heap[keep].slot], heap[keep].seq};
+    run.left = heap.size() - keep - 1;
+    vector<SpillRecord> records;
+    for (size_t i = keep + 1; ok && i < heap.size(); i += PT_SPILL_CHUNK)
+    {
+        records.clear();
+        for (size_t j = i; j < min(i + PT_SPILL_CHUNK, heap.size()); j += 1)
+        {
+            records.push_back({pool[heap[j].slot], heap[j].seq});
+        }
+        ok = fwrite(records.data(), sizeof(SpillRecord), records.size(), run.file) == records.size();
+    }
+    // 缓冲区中的内容写入失败时fflush才会报错
+    ok = ok && fflush(run.file) == 0 && fseek(run.file, 0, SEEK_SET) == 0;
+    if (!ok)
+    {
+        string reason = strerror(errno);
+        if (run.file != NULL)
+        {
+            fclose(run.file);
+        }
+        if (!run.name.empty())
+        {
+            remove(run.name.c_str());
+        }
+        throw runtime_error("PTQueue: cannot spill PTs to a temporary file: " + reason);
+    }
+    runs.push_back(run);
+
+    for (size_t i = keep; i < heap.size(); i += 1)
+    {
+        free_slots.push_back(heap[i].slot);
+    }
+    heap.resize(keep);
+    make_heap(heap.begin(), heap.end(), Lower);
+}
+
+void PTQueue::load(int r)
+{
+    // head之后的n个PT中，前n - 1个和head一起放入堆中，最后一个成为新的head
+    // 每次读入的数目不超过memory_limit的四分之一，避免刚读入就又因为超过memory_limit被写回文件
+    SpillRun &run = runs[r];
+    size_t chunk = memory_limit > 0 ? max(min((size_t)PT_SPILL_CHUNK, memory_limit / 4), (size_t)1) : PT_SPILL_CHUNK;
+    size_t n = min(chunk, run.left);
+    vector<SpillRecord> records(n);
+    // 文件中的PT读不回来就无法保证生成的猜测完整，不能当作run已经读完
+    if (fread(records.data(), sizeof(SpillRecord), n, run.file) != n)
+    {
+        throw runtime_error(string("PTQueue: cannot read spilled PTs back from a temporary file: ") +
+                            (ferror(run.file) ? strerror(errno) : "unexpected end of file"));
+    }
+    run.left -= n;
+
+    heap.push_back(place(run.head.pt, run.head.seq));
+    push_heap(heap.begin(), heap.end(), Lower);
+    for (size_t i = 0; i + 1 < n; i += 1)
+    {
+        heap.push_back(place(records[i].pt, records[i].seq));
+        push_heap(heap.begin(), heap.end(), Lower);
+    }
+    if (n > 0)
+    {
+        run.head = records[n - 1];
+        return;
+    }
+    close(run);
+    runs.erase(runs.begin() + r);
+}
+
+void PTQueue::settle()
+{
+    while (!runs.empty())
+    {
+        int best = 0;
+        for (int r = 1; r < (int)runs.size(); r += 1)
+        {
+            if (Lower(Key(runs[best].head), Key(runs[r].head)))
+            {
+                best = r;
+            }
+        }
+        if (!heap.empty() && Lower(Key(runs[best].head), heap.front()))
+        {
+            return;
+        }
+        load(best);
+    }
+}
+
+// save写入的一个run：文件名（匿名的run长度为0）、head、head之后的PT数目、文件中读到的位置
+// 匿名的run没有读入的PT跟在内存中的PT之后，依次写入
+struct SavedRunHeader
+{
+    uint64_t name_length;
+    uint64_t left;
+    int64_t offset;
+};
+
+bool PTQueue::save(FILE *file)
+{
+    size_t heap_count = heap.size();
+    size_t run_count = runs.size();
+    bool ok = fwrite(&next_seq, sizeof(next_seq), 1, file) == 1 && fwrite(&heap_count, sizeof(heap_count), 1, file) == 1 &&
+              fwrite(&run_count, sizeof(run_count), 1, file) == 1;
+    for (size_t r = 0; ok && r < runs.size(); r += 1)
+    {
+        SpillRun &run = runs[r];
+        SavedRunHeader header = {run.name.size(), run.left, ftell(run.file)};
+        ok = header.offset >= 0 && fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(run.name.data(), 1, run.name.size(), file) == run.name.size() &&
+             fwrite(&run.head, sizeof(SpillRecord), 1, file) == 1;
+        // 从现在起这个run的文件被检查点引用，读完之后也要等下一个检查点写入才能删除
+        run.saved = true;
+    }
+    // 内存中的PT分段写入，不需要一次复制整个堆
+    vector<SpillRecord> records;
+    for (size_t i = 0; ok && i < heap.size(); i += PT_SPILL_CHUNK)
+    {
+        records.clear();
+        for (size_t j = i; j < min(i + PT_SPILL_CHUNK, heap.size()); j += 1)
+        {
+            records.push_back({pool[heap[j].slot], heap[j].seq});
+        }
+        ok = fwrite(records.data(), sizeof(SpillRecord), records.size(), file) == records.size();
+    }
+    // 匿名的run在程序退出后就不存在了，只能把还没有读入的PT复制下来，复制完再回到原来读到的位置
+    for (SpillRun &run : runs)
+    {
+        if (!ok || !run.name.empty())
+        {
+            continue;
+        }
+        long pos = ftell(run.file);
+        for (size_t left = run.left; ok && left > 0;)
+        {
+            size_t n = min(left, (size_t)PT_SPILL_CHUNK);
+            records.resize(n);
+            ok = fread(records.data(), sizeof(SpillRecord), n, run.file) == n &&
+                 fwrite(records.data(), sizeof(SpillRecord), n, file) == n;
+            left -= n;
+        }
+        ok = fseek(run.file, pos, SEEK_SET) == 0 && ok;
+    }
+    return ok;
+}
+
+bool PTQueue::load(FILE *file, string &error)
+{
+    size_t seq, heap_count, run_count;
+    if (fread(&seq, sizeof(seq), 1, file) != 1 || fread(&heap_count, sizeof(heap_count), 1, file) != 1 ||
+        fread(&run_count, sizeof(run_count), 1, file) != 1)
+    {
+        error = "truncated queue header";
+        return false;
+    }
+    // 先读入所有run的信息并打开有名字的run，再检查文件的剩余部分刚好是内存中的PT和匿名run的PT，
+    // 之后的读取不会中途失败，队列也就不会只恢复一半
+    vector<SpillRun> loaded;
+    size_t inline_count = heap_count;
+    auto fail = [&](const string &reason) {
+        for (SpillRun &run : loaded)
+        {
+            if (run.file != NULL)
+            {
+                fclose(run.file);
+            }
+        }
+        error = reason;
+        return false;
+    };
+    for (size_t r = 0; r < run_count; r += 1)
+    {
+        SavedRunHeader header;
+        if (fread(&header, sizeof(header), 1, file) != 1 || header.name_length > 4096)
+        {
+            return fail("truncated or corrupt run table");
+        }
+        SpillRun run;
+        run.file = NULL;
+        run.left = header.left;
+        run.saved = true;
+        run.name.resize(header.name_length);
+        if (fread(&run.name[0], 1, run.name.size(), file) != run.name.size() ||
+            fread(&run.head, sizeof(SpillRecord), 1, file) != 1)
+        {
+            return fail("truncated or corrupt run table");
+        }
+        if (run.name.empty())
+        {
+            // head已经读出，文件中只剩head之后的PT
+            inline_count += run.left;
+            loaded.push_back(run);
+            continue;
+        }
+        run.file = fopen(run.name.c_str(), "rb");
+        loaded.push_back(run);
+        if (run.file == NULL)
+        {
+            return fail("cannot open spilled run " + run.name + ": " + strerror(errno));
+        }
+        long end = fseek(run.file, 0, SEEK_END) == 0 ? ftell(run.file) : -1;
+        if (end < header.offset + (long)(run.left * sizeof(SpillRecord)) || fseek(run.file, header.offset, SEEK_SET) != 0)
+        {
+            return fail("spilled run " + run.name + " is shorter than the checkpoint expects");
+        }
+    }
+    long pos = ftell(file);
+    fseek(file, 0, SEEK_END);
+    if (ftell(file) - pos != (long)(inline_count * sizeof(SpillRecord)))
+    {
+        return fail("truncated or corrupt queue contents");
+    }
+    fseek(file, pos, SEEK_SET);
+
+    clear();
+    next_seq = seq;
+    // 保存时的顺序不是堆的顺序，全部读入之后再建堆；超过memory_limit时照常写入新的run
+    // 匿名run的head和其余PT都放入堆中，之后与其他PT一样按memory_limit写入临时文件
+    vector<SpillRecord> records;
+    for (SpillRun &run : loaded)
+    {
+        if (run.name.empty())
+        {
+            heap.push_back(place(run.head.pt, run.head.seq));
+        }
+        else
+        {
+            runs.push_back(run);
+            // 刚刚关闭的run可能就是检查点引用的文件，不能再被prune删除
+            retired.erase(remove(retired.begin(), retired.end(), run.name), retired.end());
+        }
+    }
+    for (size_t left = inline_count; left > 0;)
+    {
+        size_t n = min(left, (size_t)PT_SPILL_CHUNK);
+        records.resize(n);
+        if (fread(records.data(), sizeof(SpillRecord), n, file) != n)
+        {
+            // 文件的大小已经检查过，只有读取出错时才会到这里。这时队列已经被替换了一部分，不能再使用
+            error = string("cannot read queue contents: ") + (ferror(file) ? strerror(errno) : "unexpected end of file");
+            clear();
+            return false;
+        }
+        for (const SpillRecord &record : records)
+        {
+            heap.push_back(place(record.pt, record.seq));
+        }
+        if (memory_limit > 0 && heap.size() > memory_limit)
+        {
+            spill();
+        }
+        left -= n;
+    }
+    make_heap(heap.begin(), heap.end(), Lower);
+    return true;
+}
+
+PT &PTQueue::top()
+{
+    settle();
+    return pool[heap.front().slot];
+}
+
+void PTQueue::pop()
+{
+    settle();
+    pop_heap(heap.begin(), heap.end(), Lower);
+    free_slots.push_back(heap.back().slot);
+    heap.pop_back();
+}
+
 void PriorityQueue::CalProb(PT &pt)
 {
     // 计算PriorityQueue里面一个PT的流程如下：
@@ -10,7 +517,8 @@ void PriorityQueue::CalProb(PT &pt)
     // 4. 这个时候就需要计算123456在L6中出现的概率了。假设123456在所有L6 segment中的概率为0.1，那么123456S1的概率就是0.1*0.15
 
     // 计算一个PT本身的概率。后续所有具体segment value的概率，直接累乘在这个初始概率值上
-    pt.prob = pt.preterm_prob;
+    // 概率以对数表示，累乘就是累加（见LogProb）
+    pt.log_prob = pt.preterm_log_prob;
 
     // index: 标注当前segment在PT中的位置
     int index = 0;
@@ -18,36 +526,22 @@ void PriorityQueue::CalProb(PT &pt)
 
     for (int idx : pt.curr_indices)
     {
-        // pt.content[index].PrintSeg();
-        if (pt.content[index].type == 1)
-        {
-            // 下面这行代码的意义：
-            // pt.content[index]：目前需要计算概率的segment
-            // m.FindLetter(seg): 找到一个letter segment在模型中的对应下标
-            // m.letters[m.FindLetter(seg)]：一个letter segment在模型中对应的所有统计数据
-            // m.letters[m.FindLetter(seg)].ordered_values：一个letter segment在模型中，所有value的总数目
-            pt.prob *= m.letters[m.FindLetter(pt.content[index])].ordered_freqs[idx];
-            pt.prob /= m.letters[m.FindLetter(pt.content[index])].total_freq;
-            // cout << m.letters[m.FindLetter(pt.content[index])].ordered_freqs[idx] << endl;
-            // cout << m.letters[m.FindLetter(pt.content[index])].total_freq << endl;
-        }
-        if (pt.content[index].type == 2)
-        {
-            pt.prob *= m.digits[m.FindDigit(pt.content[index])].ordered_freqs[idx];
-            pt.prob /= m.digits[m.FindDigit(pt.content[index])].total_freq;
-            // cout << m.digits[m.FindDigit(pt.content[index])].ordered_freqs[idx] << endl;
-            // cout << m.digits[m.FindDigit(pt.content[index])].total_freq << endl;
-        }
-        if (pt.content[index].type == 3)
-        {
-            pt.prob *= m.symbols[m.FindSymbol(pt.content[index])].ordered_freqs[idx];
-            pt.prob /= m.symbols[m.FindSymbol(pt.content[index])].total_freq;
-            // cout << m.symbols[m.FindSymbol(pt.content[index])].ordered_freqs[idx] << endl;
-            // cout << m.symbols[m.FindSymbol(pt.content[index])].total_freq << endl;
-        }
+        // 下面这行代码的意义：
+        // pt.content[index]：目前需要计算概率的segment
+        // m.GetSegment(seg)：这个segment在模型中对应的所有统计数据，按类型和长度直接索引，不需要查找
+        // log_probs[idx]：当前value在这个segment的所有value中的概率（ordered_freqs[idx] / total_freq）的对数
+        pt.log_prob += m.GetSegment(pt.content[index]).log_probs[idx];
         index += 1;
     }
-    // cout << pt.prob << endl;
+    // cout << pt.log_prob << endl;
+}
+
+void PriorityQueue::UpdateProb(const PT &parent, PT &child)
+{
+    // NewPTs把第pivot个segment的下标加1，其余segment不变
+    int i = child.pivot;
+    const segment &seg = m.GetSegment(child.content[i]);
+    child.log_prob = parent.log_prob - seg.log_probs[child.curr_indices[i] - 1] + seg.log_probs[child.curr_indices[i]];
 }
 
 void PriorityQueue::init()
@@ -56,79 +550,66 @@ void PriorityQueue::init()
     // 用所有可能的PT，按概率降序填满整个优先队列
     for (PT pt : m.ordered_pts)
     {
-        for (segment seg : pt.content)
-        {
-            if (seg.type == 1)
-            {
-                // 下面这行代码的意义：
-                // max_indices用来表示PT中各个segment的可能数目。例如，L6S1中，假设模型统计到了100个L6，那么L6对应的最大下标就是99
-                // （但由于后面采用了"<"的比较关系，所以其实max_indices[0]=100）
-                // m.FindLetter(seg): 找到一个letter segment在模型中的对应下标
-                // m.letters[m.FindLetter(seg)]：一个letter segment在模型中对应的所有统计数据
-                // m.letters[m.FindLetter(seg)].ordered_values：一个letter segment在模型中，所有value的总数目
-                pt.max_indices.emplace_back(m.letters[m.FindLetter(seg)].ordered_values.size());
-            }
-            if (seg.type == 2)
-            {
-                pt.max_indices.emplace_back(m.digits[m.FindDigit(seg)].ordered_values.size());
-            }
-            if (seg.type == 3)
-            {
-                pt.max_indices.emplace_back(m.symbols[m.FindSymbol(seg)].ordered_values.size());
-            }
-        }
-        pt.preterm_prob = float(m.preterm_freq[m.FindPT(pt)]) / m.total_preterm;
-        // pt.PrintPT();
-        // cout << " " << m.preterm_freq[m.FindPT(pt)] << " " << m.total_preterm << " " << pt.preterm_prob << endl;
-
-        // 计算当前pt的概率
-        CalProb(pt);
+        InitPT(pt);
         // 将PT放入优先队列
-        priority.emplace_back(pt);
+        priority.push(pt);
     }
     // cout << "priority size:" << priority.size() << endl;
 }
 
+void PriorityQueue::InitPT(PT &pt)
+{
+    for (const PTSegment &seg : pt.content)
+    {
+        // 下面这行代码的意义：
+        // max_indices用来表示PT中各个segment的可能数目。例如，L6S1中，假设模型统计到了100个L6，那么L6对应的最大下标就是99
+        // （但由于后面采用了"<"的比较关系，所以其实max_indices[0]=100）
+        // m.GetSegment(seg)：这个segment在模型中对应的所有统计数据
+        // m.GetSegment(seg).ordered_values：这个segment在模型中，所有value的总数目
+        pt.max_indices.emplace_back(m.GetSegment(seg).ordered_values.size());
+    }
+    // 多个GuessBand可能共用q、在不同线程中同时调用InitPT，这里只能读模型：operator[]在找不到时会插入元素
+    const model &trained = m;
+    pt.preterm_log_prob = LogProb(double(trained.preterm_freq.at(pt.model_index)) / trained.total_preterm);
+    // pt.PrintPT();
+    // cout << " " << m.preterm_freq[pt.model_index] << " " << m.total_preterm << " " << pt.preterm_prob << endl;
+
+    // 计算当前pt的概率
+    CalProb(pt);
+}
+
 void PriorityQueue::PopNext()
 {
+    if (priority.empty())
+    {
+        return;
+    }
 
     // 对优先队列最前面的PT，首先利用这个PT生成一系列猜测
-    Generate(priority.front());
+    Generate(priority.top());
 
-    // 然后需要根据即将出队的PT，生成一系列新的PT
-    vector<PT> new_pts = priority.front().NewPTs();
-    for (PT pt : new_pts)
+    // 还有没有生成的猜测：这个PT留在队首，下次从没有生成的地方继续
+    if (chunk_size > 0 && priority.top().Remaining() > chunk_size)
     {
-        // 计算概率
-        CalProb(pt);
-        // 接下来的这个循环，作用是根据概率，将新的PT插入到优先队列中
-        for (auto iter = priority.begin(); iter != priority.end(); iter++)
-        {
-            // 对于非队首和队尾的特殊情况
-            if (iter != priority.end() - 1 && iter != priority.begin())
-            {
-                // 判定概率
-                if (pt.prob <= iter->prob && pt.prob > (iter + 1)->prob)
-                {
-                    priority.emplace(iter + 1, pt);
-                    break;
-                }
-            }
-            if (iter == priority.end() - 1)
-            {
-                priority.emplace_back(pt);
-                break;
-            }
-            if (iter == priority.begin() && iter->prob < pt.prob)
-            {
-                priority.emplace(iter, pt);
-                break;
-            }
-        }
+        priority.top().last_begin += chunk_size;
+        return;
+    }
+
+    // 然后需要根据即将出队的PT，生成一系列新的PT，并由它的概率得到新PT的概率
+    vector<PT> new_pts = priority.top().NewPTs();
+    for (PT &pt : new_pts)
+    {
+        UpdateProb(priority.top(), pt);
     }
 
     // 现在队首的PT善后工作已经结束，将其出队（删除）
-    priority.erase(priority.begin());
+    priority.pop();
+
+    for (const PT &pt : new_pts)
+    {
+        // 根据概率将新的PT放入优先队列
+        priority.push(pt);
+    }
 }
 
 // 这个函数你就算看不懂，对并行算法的实现影响也不大
@@ -164,6 +645,7 @@ vector<PT> PT::NewPTs()
                 // 更新pivot值
                 pivot = i;
                 res.emplace_back(*this);
+                res.back().last_begin = 0;
             }
 
             // 这个步骤对于你理解pivot的作用、新PT生成的过程而言，至关重要
@@ -177,6 +659,32 @@ vector<PT> PT::NewPTs()
 }
 
 
+segment *PriorityQueue::Instantiate(const PT &pt, string &prefix)
+{
+    // 对于只有一个segment的PT，前缀为空，直接遍历生成其中的所有value即可
+    if (pt.content.size() == 1)
+    {
+        return &m.GetSegment(pt.content[0]);
+    }
+
+    int seg_idx = 0;
+    // 这个for循环的作用：给当前PT的所有segment赋予实际的值（最后一个segment除外）
+    // segment值根据curr_indices中对应的值加以确定
+    // 这个for循环你看不懂也没太大问题，并行算法不涉及这里的加速
+    for (int idx : pt.curr_indices)
+    {
+        prefix += m.GetSegment(pt.content[seg_idx]).ordered_values[idx];
+        seg_idx += 1;
+        if (seg_idx == pt.content.size() - 1)
+        {
+            break;
+        }
+    }
+
+    // 指向最后一个segment的指针，这个指针实际指向模型中的统计数据
+    return &m.GetSegment(pt.content[pt.content.size() - 1]);
+}
+
 // 这个函数是PCFG并行化算法的主要载体
 // 尽量看懂，然后进行并行实现
 void PriorityQueue::Generate(PT pt)
@@ -184,90 +692,268 @@ void PriorityQueue::Generate(PT pt)
     // 计算PT的概率，这里主要是给PT的概率进行初始化
     CalProb(pt);
 
-    // 对于只有一个segment的PT，直接遍历生成其中的所有value即可
-    if (pt.content.size() == 1)
+    string guess;
+    segment *a = Instantiate(pt, guess);
+
+    // 这个循环本质上就是把模型中一个segment的所有value，赋值到PT中，形成一系列新的猜测
+    // GuessBuffer::append把这些value分给多个线程，把前缀和value直接写入guesses的缓冲区，顺序与逐个生成完全相同
+    // 分段生成时只生成从last_begin开始的至多chunk_size个value
+    int n = chunk_size > 0 ? min(pt.Remaining(), chunk_size) : pt.Remaining();
+    const string *values = a->ordered_values.data() + pt.last_begin;
+    total_guesses += n;
+    if (lazy)
+    {
+        lazy_runs.push_back({guess, values, (size_t)n});
+        return;
+    }
+    guesses.append(guess, values, n);
+}
+
+void PriorityQueue::PopBatch()
+{
+    if (priority.empty())
+    {
+        return;
+    }
+    // 需要分多次生成的PT交给PopNext
+    if (chunk_size > 0 && priority.top().Remaining() > chunk_size)
     {
-        // 指向最后一个segment的指针，这个指针实际指向模型中的统计数据
-        segment *a;
-        // 在模型中定位到这个segment
-        if (pt.content[0].type == 1)
+        PopNext();
+        return;
+    }
+
+    // 按概率从高到低取出这一批PT，一批的猜测总数不超过chunk_size
+    vector<PT> batch;
+    int batch_guesses = 0;
+    // 概率不低于队首的(1 - max_deviation)倍，即对数概率不低于队首加上ln(1 - max_deviation)
+    long long cutoff = max_deviation < 1 ? priority.top().log_prob + LogProb(1 - max_deviation) : LLONG_MIN;
+    while (!priority.empty() && (int)batch.size() < batch_size &&
+           (batch.empty() || (priority.top().log_prob >= cutoff &&
+                              (chunk_size == 0 || batch_guesses + priority.top().Remaining() <= chunk_size))))
+    {
+        batch_guesses += priority.top().Remaining();
+        // 出队之后pool中的这个PT不再使用，可以直接移走
+        batch.emplace_back(std::move(priority.top()));
+        priority.pop();
+    }
+    int k = batch.size();
+
+    // 各个PT的前缀、最后一个segment和子PT互不相关，由多个线程同时计算
+    vector<string> prefix(k);
+    vector<segment *> last(k);
+    vector<vector<PT>> children(k);
+#pragma omp parallel for schedule(dynamic) if (k > 1)
+    for (int b = 0; b < k; b += 1)
+    {
+        last[b] = Instantiate(batch[b], prefix[b]);
+        children[b] = batch[b].NewPTs();
+        for (PT &pt : children[b])
         {
-            a = &m.letters[m.FindLetter(pt.content[0])];
+            UpdateProb(batch[b], pt);
         }
-        if (pt.content[0].type == 2)
+    }
+
+    if (lazy)
+    {
+        // 只按出队的顺序记下各个PT的前缀和最后一个segment
+        for (int b = 0; b < k; b += 1)
         {
-            a = &m.digits[m.FindDigit(pt.content[0])];
+            int n = batch[b].Remaining();
+            total_guesses += n;
+            lazy_runs.push_back({std::move(prefix[b]), last[b]->ordered_values.data() + batch[b].last_begin, (size_t)n});
         }
-        if (pt.content[0].type == 3)
+    }
+    else
+    {
+        // 按出队的顺序为各个PT的猜测预留位置，再由多个线程各自写入
+        vector<size_t> first(k);
+        for (int b = 0; b < k; b += 1)
         {
-            a = &m.symbols[m.FindSymbol(pt.content[0])];
+            int n = batch[b].Remaining();
+            first[b] = guesses.reserve(prefix[b].size(), last[b]->ordered_values.data() + batch[b].last_begin, n);
+            total_guesses += n;
         }
-        
-        // Multi-thread TODO：
-        // 这个for循环就是你需要进行并行化的主要部分了，特别是在多线程&GPU编程任务中
-        // 可以看到，这个循环本质上就是把模型中一个segment的所有value，赋值到PT中，形成一系列新的猜测
-        // 这个过程是可以高度并行化的
-        for (int i = 0; i < pt.max_indices[0]; i += 1)
+#pragma omp parallel for schedule(dynamic) if (k > 1)
+        for (int b = 0; b < k; b += 1)
         {
-            string guess = a->ordered_values[i];
-            // cout << guess << endl;
-            guesses.emplace_back(guess);
-            total_guesses += 1;
+            int n = batch[b].Remaining();
+            guesses.fill(first[b], prefix[b], last[b]->ordered_values.data() + batch[b].last_begin, n);
         }
     }
-    else
+
+    // 所有子PT一起放回队列
+    if (k == 1)
+    {
+        priority.push(children[0]);
+        return;
+    }
+    vector<PT> new_pts;
+    for (int b = 0; b < k; b += 1)
+    {
+        move(children[b].begin(), children[b].end(), back_inserter(new_pts));
+    }
+    priority.push(new_pts);
+}
+
+size_t GuessStream::NextBatch(vector<GuessRun> &runs, size_t n)
+{
+    size_t produced = 0;
+    while (produced < n && !done())
     {
-        string guess;
-        int seg_idx = 0;
-        // 这个for循环的作用：给当前PT的所有segment赋予实际的值（最后一个segment除外）
-        // segment值根据curr_indices中对应的值加以确定
-        // 这个for循环你看不懂也没太大问题，并行算法不涉及这里的加速
-        for (int idx : pt.curr_indices)
+        q.PopBatch();
+        for (GuessRun &run : q.lazy_runs)
         {
-            if (pt.content[seg_idx].type == 1)
-            {
-                guess += m.letters[m.FindLetter(pt.content[seg_idx])].ordered_values[idx];
-            }
-            if (pt.content[seg_idx].type == 2)
-            {
-                guess += m.digits[m.FindDigit(pt.content[seg_idx])].ordered_values[idx];
-            }
-            if (pt.content[seg_idx].type == 3)
-            {
-                guess += m.symbols[m.FindSymbol(pt.content[seg_idx])].ordered_values[idx];
-            }
-            seg_idx += 1;
-            if (seg_idx == pt.content.size() - 1)
-            {
-                break;
-            }
+            produced += run.n;
+            total += run.n;
+            runs.push_back(std::move(run));
         }
+        q.lazy_runs.clear();
+    }
+    return produced;
+}
 
-        // 指向最后一个segment的指针，这个指针实际指向模型中的统计数据
-        segment *a;
-        if (pt.content[pt.content.size() - 1].type == 1)
+size_t GuessStream::NextBatch(GuessBuffer &guesses, size_t n)
+{
+    vector<GuessRun> runs;
+    size_t produced = NextBatch(runs, n);
+    for (const GuessRun &run : runs)
+    {
+        guesses.append(run.prefix, run.values, run.n);
+    }
+    return produced;
+}
+
+// 检查点文件的开头，之后是PTQueue::save写入的内容
+struct CheckpointHeader
+{
+    char magic[8];
+    uint64_t fingerprint;
+    uint64_t generated;
+    long long total_guesses;
+};
+// 版本2：有名字的run只记下文件名和位置，见PTQueue::save
+static const char checkpoint_magic[8] = {'P', 'C', 'F', 'G', 'C', 'K', 'P', '2'};
+
+bool GuessStream::Save(const string &path)
+{
+    string tmp = path + ".tmp";
+    FILE *file = fopen(tmp.c_str(), "wb");
+    if (file == NULL)
+    {
+        return false;
+    }
+    CheckpointHeader header;
+    memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+    header.fingerprint = q.m.fingerprint;
+    header.generated = total;
+    header.total_guesses = q.total_guesses;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && q.priority.save(file);
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        remove(tmp.c_str());
+        return false;
+    }
+    // 旧的检查点已经被替换，它引用的、已经读完的run文件不再需要
+    q.priority.prune();
+    return true;
+}
+
+bool GuessStream::Restore(const string &path, string &error)
+{
+    error.clear();
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == NULL)
+    {
+        if (errno != ENOENT)
         {
-            a = &m.letters[m.FindLetter(pt.content[pt.content.size() - 1])];
+            error = string("cannot open: ") + strerror(errno);
         }
-        if (pt.content[pt.content.size() - 1].type == 2)
+        return false;
+    }
+    CheckpointHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, checkpoint_magic, sizeof(header.magic)) != 0)
+    {
+        error = "not a checkpoint file of this version";
+    }
+    else if (header.fingerprint != q.m.fingerprint)
+    {
+        error = "saved for a different model (was the model retrained?)";
+    }
+    else if (q.priority.load(file, error))
+    {
+        // 之前的运行在这个检查点之后写入、或者已经读完的run文件都不再需要
+        q.priority.sweep();
+    }
+    fclose(file);
+    if (!error.empty())
+    {
+        return false;
+    }
+    total = header.generated;
+    q.total_guesses = header.total_guesses;
+    return true;
+}
+
+GuessBand::GuessBand(PriorityQueue &q, double p_lo, double p_hi) : q(q)
+{
+    if (!(p_lo > 0))
+    {
+        throw invalid_argument("GuessBand: p_lo must be greater than 0");
+    }
+    lo = LogProb(p_lo);
+    hi = p_hi < 1 ? LogProb(p_hi) : LLONG_MAX;
+}
+
+size_t GuessBand::NextBatch(vector<GuessRun> &runs, size_t n)
+{
+    size_t produced = 0;
+    while (produced < n && !done())
+    {
+        if (stack.empty())
         {
-            a = &m.digits[m.FindDigit(pt.content[pt.content.size() - 1])];
+            PT root = q.m.ordered_pts[next_root];
+            next_root += 1;
+            q.InitPT(root);
+            if (root.log_prob >= lo)
+            {
+                stack.push_back(root);
+            }
+            continue;
         }
-        if (pt.content[pt.content.size() - 1].type == 3)
+        PT pt = stack.back();
+        stack.pop_back();
+
+        // 子PT的概率不超过pt，低于下界的子PT及其后代都不会有落在区间内的猜测
+        vector<PT> new_pts = pt.NewPTs();
+        for (PT &child : new_pts)
         {
-            a = &m.symbols[m.FindSymbol(pt.content[pt.content.size() - 1])];
+            q.UpdateProb(pt, child);
+            if (child.log_prob >= lo)
+            {
+                stack.push_back(child);
+            }
         }
-        
-        // Multi-thread TODO：
-        // 这个for循环就是你需要进行并行化的主要部分了，特别是在多线程&GPU编程任务中
-        // 可以看到，这个循环本质上就是把模型中一个segment的所有value，赋值到PT中，形成一系列新的猜测
-        // 这个过程是可以高度并行化的
-        for (int i = 0; i < pt.max_indices[pt.content.size() - 1]; i += 1)
+
+        // pt.log_prob里包含了最后一个segment第0个value的概率，换成第j个value就是第j个猜测的概率
+        // 先算出落在区间内的value的范围，有猜测时才拼出前缀
+        segment *a = &q.m.GetSegment(pt.content[pt.content.size() - 1]);
+        const vector<long long> &log_probs = a->log_probs;
+        long long base = pt.log_prob - log_probs[0];
+        size_t values = a->ordered_values.size();
+        // log_probs降序排列：begin之前的猜测概率不低于hi，end之后的低于lo
+        size_t begin = partition_point(log_probs.begin(), log_probs.begin() + values,
+                                       [&](long long p) { return base + p >= hi; }) - log_probs.begin();
+        size_t end = partition_point(log_probs.begin() + begin, log_probs.begin() + values,
+                                     [&](long long p) { return base + p >= lo; }) - log_probs.begin();
+        if (begin < end)
         {
-            string temp = guess + a->ordered_values[i];
-            // cout << temp << endl;
-            guesses.emplace_back(temp);
-            total_guesses += 1;
+            string prefix;
+            q.Instantiate(pt, prefix);
+            runs.push_back({std::move(prefix), a->ordered_values.data() + begin, end - begin});
+            produced += end - begin;
+            total += end - begin;
         }
     }
-}
\ No newline at end of file
+    return produced;
+}
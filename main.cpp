@@ -3,19 +3,146 @@
 #include <fstream>
 #include "md5.h"
 #include <iomanip>
+#include "ring_buffer.h"
 using namespace std;
 using namespace chrono;
 
 // 编译指令如下
-// g++ main.cpp train.cpp guessing.cpp md5.cpp -o main
-// g++ main.cpp train.cpp guessing.cpp md5.cpp -o main -O1
-// g++ main.cpp train.cpp guessing.cpp md5.cpp -o main -O2
+// g++ main.cpp train.cpp guessing.cpp md5.cpp md5_avx2.cpp md5_avx512.cpp -o main -fopenmp
+// g++ main.cpp train.cpp guessing.cpp md5.cpp md5_avx2.cpp md5_avx512.cpp -o main -O1 -fopenmp
+// g++ main.cpp train.cpp guessing.cpp md5.cpp md5_avx2.cpp md5_avx512.cpp -o main -O2 -fopenmp
+// 哈希线程数为OMP_NUM_THREADS减1（至少1个），OMP_NUM_THREADS默认为所有核
+// 执行./main scaling，会在最后用1、2、4……个线程分别哈希同一批猜测，输出哈希时间随线程数的变化
+// 执行./main -c 文件名，定期把生成状态保存到这个文件（间隔见CHECKPOINT_SECONDS）；文件已经存在时从保存的地方继续生成，
+// 文件无法恢复（损坏、模型重新训练过等）时报错退出，不会覆盖它。写入临时文件的PT放在“文件名.run-XXXXXX”中，由检查点引用
+// 执行./main -d 0.05，批量出队时允许同一批PT的概率比队首低至多5%，批更大、并行度更高，但猜测的顺序只是近似按概率降序
+// 生成和哈希以流水线的方式同时进行：主线程生成猜测，凑满一批就放入环形队列，由另外的哈希线程取出计算
 
-int main()
+// 一批猜测至少有这么多个
+#define PIPELINE_BATCH 100000
+// 流水线中同时存在的批数，必须是2的幂。生成领先哈希太多时，主线程等待哈希线程归还空的批
+#define PIPELINE_DEPTH 8
+// 两次保存检查点至少间隔这么多秒
+#define CHECKPOINT_SECONDS 60
+// 并且至少是上一次保存所用时间的这么多倍：队列越大保存越慢，间隔也随之变长，保存占用的时间不超过约1/CHECKPOINT_OVERHEAD
+#define CHECKPOINT_OVERHEAD 20
+
+// 一次交给一个线程哈希的一段猜测
+// fused为true时，是第run组猜测（见GuessRun）中下标为[begin, end)的部分，直接交给MD5HashSuffixes；
+// 否则是第run组到第run_end组（不含）的全部猜测，这些组都很短，先展开再一起交给MD5Hash
+struct HashTask
+{
+    bool fused;
+    size_t run;
+    size_t run_end;
+    size_t begin;
+    size_t end;
+};
+
+// 流水线中传递的一批猜测，每个GuessRun是一个PT生成的一组猜测，见GuessStream
+struct GuessBatch
+{
+    vector<GuessRun> runs;
+};
+
+/**
+ * HashGuesses: 计算runs中所有猜测的MD5
+ * 先把猜测切成不超过hash_batch个的若干段，再用OpenMP把这些段分给各个线程
+ * 每个线程使用自己的batch_states，MD5Hash内部的调度器也都是局部变量，线程之间没有共享的可写状态
+ * @param threads 使用的线程数
+ */
+static void HashGuesses(const vector<GuessRun> &runs, int threads)
+{
+    // 同一个PT生成的猜测较多时，交给MD5HashSuffixes，不需要把猜测拼成字符串；
+    // 其余较短的组展开之后连在一起交给MD5Hash，避免每组都留下未凑满的SIMD通道
+    const size_t hash_batch = 4096;
+    const size_t fused_run = 256;
+    vector<HashTask> tasks;
+    size_t short_begin = 0;
+    size_t short_guesses = 0;
+    for (size_t r = 0; r <= runs.size(); r += 1)
+    {
+        bool fused = r < runs.size() && runs[r].n >= fused_run;
+        // 积攒的短组到了一定数目，或者遇到了长组，就先把积攒的短组作为一段
+        if (short_guesses > 0 && (r == runs.size() || fused || short_guesses + runs[r].n > hash_batch))
+        {
+            tasks.push_back({false, short_begin, r, 0, 0});
+            short_guesses = 0;
+        }
+        if (r == runs.size())
+        {
+            break;
+        }
+        if (fused)
+        {
+            for (size_t i = 0; i < runs[r].n; i += hash_batch)
+            {
+                tasks.push_back({true, r, r + 1, i, min(i + hash_batch, runs[r].n)});
+            }
+            continue;
+        }
+        if (short_guesses == 0)
+        {
+            short_begin = r;
+        }
+        short_guesses += runs[r].n;
+    }
+
+#pragma omp parallel for schedule(dynamic) num_threads(threads)
+    for (long t = 0; t < (long)tasks.size(); t += 1)
+    {
+        bit32 batch_states[hash_batch][4]; // [密码索引][MD5状态0-3]
+        const HashTask &task = tasks[t];
+        if (task.fused)
+        {
+            const GuessRun &run = runs[task.run];
+            MD5HashSuffixes(run.prefix, run.values + task.begin, batch_states, task.end - task.begin);
+            continue;
+        }
+        GuessBuffer guesses;
+        for (size_t r = task.run; r < task.run_end; r += 1)
+        {
+            guesses.append(runs[r].prefix, runs[r].values, runs[r].n);
+        }
+        MD5Hash(guesses.data(), guesses.index(), batch_states, guesses.size());
+    }
+}
+
+static int MaxThreads()
 {
-    double time_hash = 0;  // 用于MD5哈希的时间
-    double time_guess = 0; // 哈希和猜测的总时长
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+    double time_hash = 0;  // 哈希线程用于MD5哈希的时间之和
+    double time_guess = 0; // 主线程生成猜测的时间（不含等待哈希线程的时间）
     double time_train = 0; // 模型训练的总时长
+    bool scaling = false;
+    string checkpoint;
+    double deviation = 0;
+    for (int i = 1; i < argc; i += 1)
+    {
+        if (string(argv[i]) == "scaling")
+        {
+            scaling = true;
+        }
+        else if (string(argv[i]) == "-c" && i + 1 < argc)
+        {
+            checkpoint = argv[i + 1];
+            i += 1;
+        }
+        else if (string(argv[i]) == "-d" && i + 1 < argc)
+        {
+            deviation = atof(argv[i + 1]);
+            i += 1;
+        }
+    }
+
     PriorityQueue q;
     auto start_train = system_clock::now();
     q.m.train("/guessdata/Rockyou-singleLined-full.txt");
@@ -24,90 +151,190 @@ int main()
     auto duration_train = duration_cast<microseconds>(end_train - start_train);
     time_train = double(duration_train.count()) * microseconds::period::num / microseconds::period::den;
 
+    // 优先队列在内存中最多保留约100万个PT（每个PT 240字节，约240MB），更多的PT按概率写入临时文件，见PTQueue
+    q.priority.memory_limit = 1 << 20;
+    // 保存检查点时，这些文件只需要记下文件名和读到的位置，不需要复制
+    if (!checkpoint.empty())
+    {
+        q.priority.spill_prefix = checkpoint + ".run-";
+    }
     q.init();
+    // 批量出队：每次最多处理64个PT，见PriorityQueue::PopBatch
+    // 默认只把概率与队首相同的PT放进同一批，生成顺序与逐个出队完全相同；-d指定允许的偏差
+    q.batch_size = 64;
+    q.max_deviation = deviation;
+    // 一次出队最多生成一批猜测，最后一个segment很大的PT分多次生成，每一批的大小都不会超出太多
+    q.chunk_size = PIPELINE_BATCH;
     cout << "here" << endl;
-    int curr_num = 0;
+
+    // 在此处更改实验生成的猜测上限
+    int generate_n = 10000000;
+    // 猜测不展开，每个PT只给出前缀和最后一个segment，哈希时由MD5HashSuffixes直接写入SIMD通道
+    GuessStream stream(q, generate_n);
+    if (!checkpoint.empty())
+    {
+        // 只有检查点文件不存在时才从头开始；其他的失败都不能继续，否则第一次保存就会覆盖原来的检查点
+        string error;
+        if (stream.Restore(checkpoint, error))
+        {
+            cout << "Resumed from checkpoint: " << stream.generated() << " guesses" << endl;
+        }
+        else if (!error.empty())
+        {
+            cerr << "Cannot resume from checkpoint " << checkpoint << ": " << error << endl;
+            return 1;
+        }
+    }
+
+    // 流水线：主线程生成，凑满PIPELINE_BATCH个猜测就放入full；哈希线程从full取出一批计算，再把清空的批放回empty
+    // 所有的批在开始时一次分配好，之后反复使用，内存占用固定为PIPELINE_DEPTH批，不再随猜测数目增长
+    vector<GuessBatch> batches(PIPELINE_DEPTH);
+    RingBuffer<GuessBatch *> full(PIPELINE_DEPTH);
+    RingBuffer<GuessBatch *> empty(PIPELINE_DEPTH);
+    for (GuessBatch &batch : batches)
+    {
+        GuessBatch *p = &batch;
+        empty.push(p);
+    }
+    // 主线程本身也在生成时使用OpenMP（PriorityQueue::PopBatch），这里留一个核给它
+    int cores = MaxThreads();
+    int hashers = max(1, cores - 1);
+#ifdef _OPENMP
+    // 主线程的OpenMP区域只用哈希线程剩下的核，否则PopBatch会再开出cores个线程，与哈希线程争抢
+    omp_set_num_threads(max(1, cores - hashers));
+#endif
+    vector<double> hash_times(hashers, 0);
+    vector<thread> hash_threads;
+    for (int h = 0; h < hashers; h += 1)
+    {
+        hash_threads.emplace_back([&, h]() {
+#ifdef _OPENMP
+            // 每个哈希线程独自处理一批，内部的OpenMP区域（HashGuesses、GuessBuffer::append）都只用这一个线程，
+            // 否则每个哈希线程都会再开出一组线程，与主线程的PopBatch一起远远超过核数
+            omp_set_num_threads(1);
+#endif
+            GuessBatch *batch;
+            while (full.pop(batch))
+            {
+                auto start_hash = system_clock::now();
+                // 每批直接交给HashGuesses，由这个线程独自计算；多个哈希线程同时处理不同的批
+                HashGuesses(batch->runs, 1);
+                auto end_hash = system_clock::now();
+                auto duration = duration_cast<microseconds>(end_hash - start_hash);
+                hash_times[h] += double(duration.count()) * microseconds::period::num / microseconds::period::den;
+                batch->runs.clear();
+                empty.push(batch);
+            }
+        });
+    }
+
+    // 最后一批猜测的副本，用于最后的scaling测试
+    vector<GuessRun> last_runs;
+    size_t last_guesses = 0;
+
     auto start = system_clock::now();
-    // 由于需要定期清空内存，我们在这里记录已生成的猜测总数
-    int history = 0;
+    double time_wait = 0;
+    auto last_save = start;
+    double time_save = 0; // 上一次保存检查点所用的时间
     // std::ofstream a("./files/results.txt");
-    while (!q.priority.empty())
+    while (true)
     {
-        q.PopNext();
-        q.total_guesses = q.guesses.size();
-        if (q.total_guesses - curr_num >= 100000)
+        // 定期保存检查点。先等所有的批都哈希完、回到empty中，这样检查点之前生成的猜测都已经处理过，
+        // 从检查点继续时既不会漏掉也不会重复任何猜测
+        double since_save = duration_cast<microseconds>(system_clock::now() - last_save).count() / 1e6;
+        if (!checkpoint.empty() && since_save >= max((double)CHECKPOINT_SECONDS, CHECKPOINT_OVERHEAD * time_save))
         {
-            cout << "Guesses generated: " <<history + q.total_guesses << endl;
-            curr_num = q.total_guesses;
-
-            // 在此处更改实验生成的猜测上限
-            int generate_n=10000000;
-            if (history + q.total_guesses > 10000000)
+            auto start_wait = system_clock::now();
+            GuessBatch *idle[PIPELINE_DEPTH];
+            for (GuessBatch *&p : idle)
             {
-                auto end = system_clock::now();
-                auto duration = duration_cast<microseconds>(end - start);
-                time_guess = double(duration.count()) * microseconds::period::num / microseconds::period::den;
-                cout << "Guess time:" << time_guess - time_hash << "seconds"<< endl;
-                cout << "Hash time:" << time_hash << "seconds"<<endl;
-                cout << "Train time:" << time_train <<"seconds"<<endl;
-                break;
+                empty.pop(p);
+            }
+            auto end_wait = system_clock::now();
+            auto duration = duration_cast<microseconds>(end_wait - start_wait);
+            time_wait += double(duration.count()) * microseconds::period::num / microseconds::period::den;
+            if (!stream.Save(checkpoint))
+            {
+                cerr << "Failed to save checkpoint: " << checkpoint << endl;
+            }
+            last_save = system_clock::now();
+            time_save = duration_cast<microseconds>(last_save - end_wait).count() / 1e6;
+            for (GuessBatch *p : idle)
+            {
+                empty.push(p);
             }
         }
-        // 为了避免内存超限，我们在q.guesses中口令达到一定数目时，将其中的所有口令取出并且进行哈希
-        // 然后，q.guesses将会被清空。为了有效记录已经生成的口令总数，维护一个history变量来进行记录
-        if (curr_num > 1000000)
+
+        // 取一个空的批。哈希跟不上时，空的批会被用完，主线程在这里等待
+        auto start_wait = system_clock::now();
+        GuessBatch *batch = nullptr;
+        empty.pop(batch);
+        auto end_wait = system_clock::now();
+        auto duration = duration_cast<microseconds>(end_wait - start_wait);
+        time_wait += double(duration.count()) * microseconds::period::num / microseconds::period::den;
+
+        // 从流中拉取下一批猜测，直接放入这个批
+        size_t n = stream.NextBatch(batch->runs, PIPELINE_BATCH);
+        if (n == 0)
+        {
+            break;
+        }
+        cout << "Guesses generated: " << stream.generated() << endl;
+        if (scaling)
+        {
+            last_runs = batch->runs;
+            last_guesses = n;
+        }
+        full.push(batch);
+    }
+    auto end_guess = system_clock::now();
+    full.close();
+    for (thread &t : hash_threads)
+    {
+        t.join();
+    }
+    // 所有的猜测都已经哈希完，保存最终的状态，之后提高生成上限可以从这里继续
+    if (!checkpoint.empty() && !stream.Save(checkpoint))
+    {
+        cerr << "Failed to save checkpoint: " << checkpoint << endl;
+    }
+    auto end = system_clock::now();
+    for (double t : hash_times)
+    {
+        time_hash += t;
+    }
+    auto duration = duration_cast<microseconds>(end_guess - start);
+    time_guess = double(duration.count()) * microseconds::period::num / microseconds::period::den - time_wait;
+    duration = duration_cast<microseconds>(end - start);
+    double time_pipeline = double(duration.count()) * microseconds::period::num / microseconds::period::den;
+    cout << "Guess time:" << time_guess << "seconds" << endl;
+    cout << "Hash time:" << time_hash << "seconds" << endl;
+    cout << "Pipeline time:" << time_pipeline << "seconds" << endl;
+    cout << "Hash backend:" << MD5BackendName() << " (" << MD5Lanes() << " lanes)" << endl;
+    cout << "Hash threads:" << hashers << endl;
+    cout << "Train time:" << time_train << "seconds" << endl;
+
+    // 用不同的线程数再哈希一遍最后一批猜测，报告哈希时间随线程数的变化
+    if (scaling)
+    {
+        double time_single = 0;
+        for (int threads = 1;; threads = min(threads * 2, cores))
         {
             auto start_hash = system_clock::now();
-            bit32 batch_states[2][4]; // [密码索引][MD5状态0-3]
-			size_t total = q.guesses.size();
-			for (size_t i = 0; i < total; i += 2) {
-				// 准备四个密码的数组  
-				std::string batch[2];
-				size_t remain = total - i;
-				size_t batch_size = (remain >= 2) ? 2 : remain;
-
-				// 填充当前批次的密码  
-				for (size_t j = 0; j < batch_size; ++j) 
-                {
-					batch[j] = q.guesses[i + j];
-				}
-
-				// 如果不足四个，用空字符串补齐 (需要 MD5Hash 处理空输入)  
-				for (size_t j = batch_size; j < 2; ++j) {
-					batch[j] = "";
-				}
-
-
-				// 这里我们将 batch 作为数组传递  
-				MD5Hash(batch, batch_states);
-
-
-			}
-            /*
-            bit32 state[4];
-            for (string pw : q.guesses)
-            {
-                // TODO：对于SIMD实验，将这里替换成你的SIMD MD5函数
-                MD5Hash(pw, state);
-
-                // 以下注释部分用于输出猜测和哈希，但是由于自动测试系统不太能写文件，所以这里你可以改成cout
-                // a<<pw<<"\t";
-                // for (int i1 = 0; i1 < 4; i1 += 1)
-                // {
-                //     a << std::setw(8) << std::setfill('0') << hex << state[i1];
-                // }
-                // a << endl;
-            }
-            */
-            // 在这里对哈希所需的总时长进行计算
+            HashGuesses(last_runs, threads);
             auto end_hash = system_clock::now();
             auto duration = duration_cast<microseconds>(end_hash - start_hash);
-            time_hash += double(duration.count()) * microseconds::period::num / microseconds::period::den;
-
-            // 记录已经生成的口令总数
-            history += curr_num;
-            curr_num = 0;
-            q.guesses.clear();
+            double time_threads = double(duration.count()) * microseconds::period::num / microseconds::period::den;
+            if (threads == 1)
+            {
+                time_single = time_threads;
+            }
+            cout << "Hash scaling: " << threads << " threads, " << last_guesses << " guesses, "
+                 << time_threads << "seconds, speedup " << time_single / time_threads << endl;
+            if (threads == cores)
+            {
+                break;
+            }
         }
     }
-}
\ No newline at end of file
+}
@@ -1,520 +1,975 @@
-#include "md5.h"
+#include "md5_simd.h"
 #include <iomanip>
 #include <assert.h>
 #include <chrono>
 #include <algorithm>
+#include <fstream>
 using namespace std;
 using namespace chrono;
 
 /**
- * StringProcess: 将单个输入字符串转换成MD5计算所需的消息数组
- * @param input 输入
- * @param[out] n_byte 用于给调用者传递额外的返回值，即最终Byte数组的长度
- * @return Byte消息数组
+ * MD5BlockCount: 一个长度为length字节的消息，在padding之后一共有多少个512bit的block
+ * padding时先补一个0x80，再补0直到length%64==56，最后附加8个字节的原始消息长度（以bit为单位）
+ * 需要注意的是，即便给定的消息满足length%64==56，也需要再pad一整个block
  */
-Byte* StringProcess(string input, int* n_byte)
+static inline int MD5BlockCount(size_t length)
 {
-	// 将输入的字符串转换为Byte为单位的数组
-	Byte* blocks = (Byte*)input.c_str();
-	int length = input.length();
+	return (int)((length + 8) / 64 + 1);
+}
 
-	// 计算原始消息长度（以比特为单位）
-	int bitLength = length * 8;
+// padding之后只有一个block的消息的最大长度
+#define MD5_SINGLE_BLOCK 55
 
-	// paddingBits: 原始消息需要的padding长度（以bit为单位）
-	// 对于给定的消息，将其补齐至length%512==448为止
-	// 需要注意的是，即便给定的消息满足length%512==448，也需要再pad 512bits
-	int paddingBits = bitLength % 512;
-	if (paddingBits > 448)
+/**
+ * MD5GetBlock: 取出padding之后的消息的第i个block，整个过程不需要在堆上分配内存
+ * 完全落在原始消息内的block直接返回指向原始消息的指针；
+ * 只有最后一两个需要padding的block才会被构造到调用者提供的buffer（通常在栈上）中
+ * 绝大多数口令都不超过55个字节，只有一个block，这时buffer就是整个填充好的消息
+ * @param msg 原始消息
+ * @param length 原始消息的长度（以Byte为单位）
+ * @param i block的下标
+ * @param buffer 64字节的缓冲区
+ * @return 指向第i个block的64个字节
+ */
+static inline const Byte *MD5GetBlock(const Byte *msg, size_t length, int i, Byte buffer[64])
+{
+	size_t offset = (size_t)i * 64;
+	if (offset + 64 <= length)
 	{
-		paddingBits = 512 - (paddingBits - 448);
+		return msg + offset;
 	}
-	else if (paddingBits < 448)
+
+	// 复制原始消息剩余的部分
+	size_t remain = length > offset ? length - offset : 0;
+	memcpy(buffer, msg + offset, remain);
+	memset(buffer + remain, 0, 64 - remain);
+	// 添加填充字节。填充时，第一位为1，后面的所有位均为0。所以第一个byte是0x80
+	// 如果消息刚好在上一个block中结束，0x80已经写在上一个block里了
+	if (length >= offset)
 	{
-		paddingBits = 448 - paddingBits;
+		buffer[remain] = 0x80;
 	}
-	else if (paddingBits == 448)
+	// 最后一个block的末尾8个字节是消息长度（64比特，小端格式）
+	if (i == MD5BlockCount(length) - 1)
 	{
-		paddingBits = 512;
+		for (int k = 0; k < 8; ++k)
+		{
+			// 特别注意此处应当将bitLength转换为uint64_t
+			buffer[56 + k] = ((uint64_t)length * 8 >> (k * 8)) & 0xFF;
+		}
 	}
+	return buffer;
+}
+
+// 一个MD5后端：通道数，对这么多通道各压缩一个block的函数，从state得到最终MD5的函数，
+// 用目标位图对所有通道做前置过滤的函数，单目标破解时只算前若干步就比较的函数，
+// 以及所有通道共享前缀时跳过第一轮前若干步的压缩函数
+struct MD5Backend
+{
+	const char *name;
+	int lanes;
+	void (*compress)(bit32 *state, const Byte *const block[]);
+	void (*digest)(const bit32 *state, bit32 *out);
+	unsigned (*filter)(const bit32 *state, const bit32 *bitmap, int shift);
+	unsigned (*reverse)(const Byte *const block[], int stop, const bit32 *target, int n_targets);
+	void (*compress_prefix)(bit32 *state, const bit32 mid[4], int start, const Byte *const block[]);
+};
+
+static void MD5Compress_default(bit32 *state, const Byte *const block[])
+{
+	MD5CompressBlocks<md5_vec>(state, block);
+}
 
-	// 原始消息需要的padding长度（以Byte为单位）
-	int paddingBytes = paddingBits / 8;
-	// 创建最终的字节数组
-	// length + paddingBytes + 8:
-	// 1. length为原始消息的长度（bits）
-	// 2. paddingBytes为原始消息需要的padding长度（Bytes）
-	// 3. 在pad到length%512==448之后，需要额外附加64bits的原始消息长度，即8个bytes
-	int paddedLength = length + paddingBytes + 8;
-	Byte* paddedMessage = new Byte[paddedLength];
+static void MD5Digest_default(const bit32 *state, bit32 *out)
+{
+	MD5DigestLanes<md5_vec>(state, out);
+}
 
-	// 复制原始消息
-	memcpy(paddedMessage, blocks, length);
+static unsigned MD5Filter_default(const bit32 *state, const bit32 *bitmap, int shift)
+{
+	return MD5FilterLanes<md5_vec>(state, bitmap, shift);
+}
 
-	// 添加填充字节。填充时，第一位为1，后面的所有位均为0。
-	// 所以第一个byte是0x80
-	paddedMessage[length] = 0x80;							 // 添加一个0x80字节
-	memset(paddedMessage + length + 1, 0, paddingBytes - 1); // 填充0字节
+static unsigned MD5Reverse_default(const Byte *const block[], int stop, const bit32 *target, int n_targets)
+{
+	return MD5ReverseLanes<md5_vec>(block, stop, target, n_targets);
+}
+
+static void MD5CompressPrefix_default(bit32 *state, const bit32 mid[4], int start, const Byte *const block[])
+{
+	MD5CompressPrefix<md5_vec>(state, mid, start, block);
+}
 
-	// 添加消息长度（64比特，小端格式）
-	for (int i = 0; i < 8; ++i)
+static void MD5Compress_scalar(bit32 *state, const Byte *const block[])
+{
+	MD5CompressBlocks<md5_lanes<4> >(state, block);
+}
+
+static void MD5Digest_scalar(const bit32 *state, bit32 *out)
+{
+	MD5DigestLanes<md5_lanes<4> >(state, out);
+}
+
+static unsigned MD5Filter_scalar(const bit32 *state, const bit32 *bitmap, int shift)
+{
+	return MD5FilterLanes<md5_lanes<4> >(state, bitmap, shift);
+}
+
+static unsigned MD5Reverse_scalar(const Byte *const block[], int stop, const bit32 *target, int n_targets)
+{
+	return MD5ReverseLanes<md5_lanes<4> >(block, stop, target, n_targets);
+}
+
+static void MD5CompressPrefix_scalar(bit32 *state, const bit32 mid[4], int start, const Byte *const block[])
+{
+	MD5CompressPrefix<md5_lanes<4> >(state, mid, start, block);
+}
+
+// 从宽到窄排列，选择时取第一个CPU支持的
+static const MD5Backend md5_backends[] = {
+#if defined(__x86_64__) || defined(__i386__)
+	{"avx512", 16, MD5Compress_avx512, MD5Digest_avx512, MD5Filter_avx512, MD5Reverse_avx512, MD5CompressPrefix_avx512},
+	{"avx2", 8, MD5Compress_avx2, MD5Digest_avx2, MD5Filter_avx2, MD5Reverse_avx2, MD5CompressPrefix_avx2},
+#endif
+#if defined(__ARM_NEON)
+	{"neon", sizeof(md5_vec) / sizeof(bit32), MD5Compress_default, MD5Digest_default, MD5Filter_default, MD5Reverse_default, MD5CompressPrefix_default},
+#elif defined(__SSE2__)
+	{"sse2", sizeof(md5_vec) / sizeof(bit32), MD5Compress_default, MD5Digest_default, MD5Filter_default, MD5Reverse_default, MD5CompressPrefix_default},
+#endif
+	{"scalar", 4, MD5Compress_scalar, MD5Digest_scalar, MD5Filter_scalar, MD5Reverse_scalar, MD5CompressPrefix_scalar},
+};
+
+// 用cpuid判断CPU（以及操作系统）是否支持某个后端
+static bool MD5BackendSupported(const MD5Backend &backend)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	if (strcmp(backend.name, "avx512") == 0)
 	{
-		// 特别注意此处应当将bitLength转换为uint64_t
-		// 这里的length是原始消息的长度
-		paddedMessage[length + paddingBytes + i] = ((uint64_t)length * 8 >> (i * 8)) & 0xFF;
+		return __builtin_cpu_supports("avx512f");
 	}
+	if (strcmp(backend.name, "avx2") == 0)
+	{
+		return __builtin_cpu_supports("avx2");
+	}
+#endif
+	return true;
+}
 
-	// 验证长度是否满足要求。此时长度应当是512bit的倍数
-	int residual = 8 * paddedLength % 512;
-	// assert(residual == 0);
+static const MD5Backend *MD5DetectBackend()
+{
+	for (const MD5Backend &backend : md5_backends)
+	{
+		if (MD5BackendSupported(backend))
+		{
+			return &backend;
+		}
+	}
+	return NULL;
+}
 
-	// 在填充+添加长度之后，消息被分为n_blocks个512bit的部分
-	*n_byte = paddedLength;
-	return paddedMessage;
+// 局部静态变量的初始化是线程安全的，多个线程第一次同时调用MD5Hash也没有问题
+// MD5UseBackend会修改它，只应在开始多线程计算之前调用
+static const MD5Backend *&MD5CurrentBackend()
+{
+	static const MD5Backend *current = MD5DetectBackend();
+	return current;
+}
+
+const char *MD5BackendName()
+{
+	return MD5CurrentBackend()->name;
+}
+
+int MD5Lanes()
+{
+	return MD5CurrentBackend()->lanes;
 }
 
+bool MD5UseBackend(const char *name)
+{
+	for (const MD5Backend &backend : md5_backends)
+	{
+		if (strcmp(backend.name, name) == 0 && MD5BackendSupported(backend))
+		{
+			MD5CurrentBackend() = &backend;
+			return true;
+		}
+	}
+	return false;
+}
+
+// 一个通道上要计算的消息，以及结果的存放位置
+// 破解模式下不输出MD5，digest不使用，命中时输出id
+struct MD5Lane
+{
+	const Byte *msg;
+	size_t length;
+	bit32 *digest;
+	size_t id;
+};
+
+// 计算结果的去向：targets为NULL时把MD5写入各通道的digest；
+// 否则只把MD5属于targets的通道的id追加到hits中
+struct MD5Output
+{
+	const MD5TargetSet *targets;
+	vector<size_t> *hits;
+};
+
+// n个输入消息：strings不为NULL时是string数组，
+// 否则是连续存放的缓冲区，第i个消息是data中[offsets[i], offsets[i + 1])的部分
+struct MD5Input
+{
+	const string *strings;
+	const char *data;
+	const size_t *offsets;
+
+	const Byte *msg(size_t i) const
+	{
+		return strings != NULL ? (const Byte *)strings[i].data() : (const Byte *)data + offsets[i];
+	}
+	size_t length(size_t i) const
+	{
+		return strings != NULL ? strings[i].length() : offsets[i + 1] - offsets[i];
+	}
+};
+
+// 空闲通道使用的全0 block，它的结果不会被使用
+static const Byte md5_zero_block[64] = {0};
 
 /**
- * MD5Hash: 将4个输入字符串转换成MD5
+ * MD5LaneBlock: 取出一个通道上的消息的第i个block
+ * @param lane 通道上的消息；为NULL时表示这个通道空闲
+ * @param buffer 这个通道专用的64字节缓冲区，需要padding的block在这里构造
+ */
+static inline const Byte *MD5LaneBlock(const MD5Lane *lane, int i, Byte buffer[64])
+{
+	if (lane == NULL)
+	{
+		return md5_zero_block;
+	}
+	return MD5GetBlock(lane->msg, lane->length, i, buffer);
+}
+
+/**
+ * MD5FinishLanes: 输出已经处理完最后一个block的通道的结果
+ * 破解模式下先用位图过滤，绝大多数情况下没有通道通过，这时连最终MD5的转置都不需要做
+ * @param lane_state 所有通道的state，存放方式见MD5HashLanes
+ * @param done 第l位为1表示第l个通道处理完了
+ */
+static void MD5FinishLanes(const MD5Backend &backend, const bit32 *lane_state, const MD5Lane lane[],
+						   unsigned done, const MD5Output &output)
+{
+	if (output.targets != NULL)
+	{
+		done &= backend.filter(lane_state, &output.targets->bitmap[0], output.targets->bitmap_shift);
+		if (done == 0)
+		{
+			return;
+		}
+	}
+	bit32 digest[MD5_MAX_LANES][4];
+	backend.digest(lane_state, digest[0]);
+	for (int l = 0; l < backend.lanes; l += 1)
+	{
+		if ((done >> l & 1) == 0)
+		{
+			continue;
+		}
+		if (output.targets == NULL)
+		{
+			memcpy(lane[l].digest, digest[l], sizeof(digest[l]));
+		}
+		else if (output.targets->contains(digest[l]))
+		{
+			output.hits->push_back(lane[l].id);
+		}
+	}
+}
+
+/**
+ * MD5HashLanes: 用一组SIMD通道同时计算至多lanes个消息的MD5，所有消息的block数必须相同
+ * @param backend 使用的后端
+ * @param lane 各通道的消息，共n个
+ * @param n 消息数目，不超过backend.lanes，多出来的通道空转
+ * @param n_blocks 每个消息在padding之后的block数
+ * @param output 结果的去向
+ */
+static void MD5HashLanes(const MD5Backend &backend, const MD5Lane lane[], int n, int n_blocks, const MD5Output &output)
+{
+	const int lanes = backend.lanes;
+	// lane_state[k * lanes + l]: 第l个通道的第k个状态字
+	bit32 lane_state[4 * MD5_MAX_LANES];
+	for (int k = 0; k < 4; k += 1)
+	{
+		for (int l = 0; l < lanes; l += 1)
+		{
+			lane_state[k * lanes + l] = md5_init_state[k];
+		}
+	}
+
+	// block[l]: 第l个通道当前的block，由后端直接从这里装载并转置
+	const Byte *block[MD5_MAX_LANES];
+	Byte buffer[MD5_MAX_LANES][64];
+	// 逐block地更新state
+	for (int i = 0; i < n_blocks; i += 1)
+	{
+		for (int l = 0; l < lanes; l += 1)
+		{
+			block[l] = MD5LaneBlock(l < n ? &lane[l] : NULL, i, buffer[l]);
+		}
+		backend.compress(lane_state, block);
+	}
+
+	MD5FinishLanes(backend, lane_state, lane, (1u << n) - 1, output);
+}
+
+/**
+ * MD5Stream: 流式的多block哈希器，始终保持所有通道都有消息在计算
+ * 每个通道记录自己的消息已经处理到第几个block。每一步所有通道各压缩一个block，
+ * 某个通道的消息处理完之后立即输出结果，并在下一步之前装入下一个消息，
+ * 因此长度各不相同的长消息也不需要等待同一组中最长的那个消息
+ */
+class MD5Stream
+{
+public:
+	MD5Stream(const MD5Backend &backend, const MD5Output &output) : backend(backend), output(output), n_free(backend.lanes)
+	{
+		for (int l = 0; l < backend.lanes; l += 1)
+		{
+			free_lanes[l] = backend.lanes - 1 - l;
+			busy[l] = false;
+		}
+	}
+
+	// 加入一个消息。所有通道都被占用时，先计算到有通道空出来为止
+	void push(const MD5Lane &msg)
+	{
+		while (n_free == 0)
+		{
+			step();
+		}
+		n_free -= 1;
+		int l = free_lanes[n_free];
+		lane[l] = msg;
+		n_blocks[l] = MD5BlockCount(msg.length);
+		next_block[l] = 0;
+		busy[l] = true;
+		for (int k = 0; k < 4; k += 1)
+		{
+			lane_state[k * backend.lanes + l] = md5_init_state[k];
+		}
+	}
+
+	// 计算完所有还在通道中的消息
+	void flush()
+	{
+		while (n_free < backend.lanes)
+		{
+			step();
+		}
+	}
+
+private:
+	// 所有通道各压缩一个block，并输出刚好处理完的通道的结果
+	void step()
+	{
+		const int lanes = backend.lanes;
+		const Byte *block[MD5_MAX_LANES] = {};
+		for (int l = 0; l < lanes; l += 1)
+		{
+			block[l] = MD5LaneBlock(busy[l] ? &lane[l] : NULL, next_block[l], buffer[l]);
+		}
+		backend.compress(lane_state, block);
+
+		unsigned done = 0;
+		for (int l = 0; l < lanes; l += 1)
+		{
+			if (busy[l])
+			{
+				next_block[l] += 1;
+				if (next_block[l] == n_blocks[l])
+				{
+					done |= 1u << l;
+					busy[l] = false;
+					free_lanes[n_free] = l;
+					n_free += 1;
+				}
+			}
+		}
+		if (done != 0)
+		{
+			MD5FinishLanes(backend, lane_state, lane, done, output);
+		}
+	}
+
+	const MD5Backend &backend;
+	MD5Output output;
+	MD5Lane lane[MD5_MAX_LANES];
+	int n_blocks[MD5_MAX_LANES];
+	int next_block[MD5_MAX_LANES];
+	bool busy[MD5_MAX_LANES];
+	// 空闲通道的编号，作为栈使用
+	int free_lanes[MD5_MAX_LANES];
+	int n_free;
+	// 各通道的state，和MD5HashLanes中的存放方式相同
+	bit32 lane_state[4 * MD5_MAX_LANES];
+	Byte buffer[MD5_MAX_LANES][64];
+};
+
+// 按block数分桶的桶数。block数达到MD5_BUCKETS的长消息长度差别很大，逐个分桶会留下很多未凑满的组，
+// 因此它们全部交给MD5Stream，由它在通道空出来时随时补充新的消息
+#define MD5_BUCKETS 4
+
+/**
+ * MD5Scheduler: 在后端前面按block数对消息分组的调度器
+ * block数相同的短消息凑满一组通道之后才交给后端，这样每一次SIMD计算中所有通道都在做有用的工作，
+ * 不会出现一部分通道已经算完、另一部分通道还在处理后面的block的情况
+ * 只有在flush时，每个桶最后一组未凑满的消息才会带着空闲通道计算
+ */
+class MD5Scheduler
+{
+public:
+	MD5Scheduler(const MD5Backend &backend, const MD5Output &output) : backend(backend), output(output), stream(backend, output)
+	{
+		for (int b = 0; b < MD5_BUCKETS; b += 1)
+		{
+			pending[b] = 0;
+		}
+	}
+
+	// 加入一个消息
+	void push(const MD5Lane &msg)
+	{
+		int n_blocks = MD5BlockCount(msg.length);
+		if (n_blocks >= MD5_BUCKETS)
+		{
+			stream.push(msg);
+			return;
+		}
+		int b = n_blocks;
+		buckets[b][pending[b]] = msg;
+		pending[b] += 1;
+		if (pending[b] == backend.lanes)
+		{
+			MD5HashLanes(backend, buckets[b], pending[b], b, output);
+			pending[b] = 0;
+		}
+	}
+
+	// 计算所有剩余的消息
+	void flush()
+	{
+		for (int b = 1; b < MD5_BUCKETS; b += 1)
+		{
+			if (pending[b] > 0)
+			{
+				MD5HashLanes(backend, buckets[b], pending[b], b, output);
+				pending[b] = 0;
+			}
+		}
+		stream.flush();
+	}
+
+private:
+	const MD5Backend &backend;
+	MD5Output output;
+	// buckets[b]: block数为b、尚未凑满一组通道的消息（buckets[0]不使用）
+	MD5Lane buckets[MD5_BUCKETS][MD5_MAX_LANES];
+	int pending[MD5_BUCKETS];
+	MD5Stream stream;
+};
+
+/**
+ * MD5HashInput: 将n个输入转换成MD5
  * @param input 输入
  * @param[out] state 用于给调用者传递额外的返回值，即最终的缓冲区，也就是MD5的结果
- * @return Byte消息数组
+ * @param n 输入数目
+ */
+static void MD5HashInput(const MD5Input &input, bit32 state[][4], size_t n)
+{
+	MD5Output output = {NULL, NULL};
+	MD5Scheduler scheduler(*MD5CurrentBackend(), output);
+	for (size_t i = 0; i < n; i += 1)
+	{
+		MD5Lane lane = {input.msg(i), input.length(i), state[i], i};
+		scheduler.push(lane);
+	}
+	scheduler.flush();
+}
+
+static inline bit32 md5_bswap32(bit32 x)
+{
+	return (x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) | (x << 24);
+}
+
+// 目标不超过这么多个时，MD5Crack对单block消息使用MD5Reverser
+#define MD5_REVERSE_TARGETS 4
+
+// 第4轮（第49~64步）各步使用的消息字下标、循环左移位数和常数，用于从目标MD5往回推
+static const int md5_r4_index[16] = {0, 7, 14, 5, 12, 3, 10, 1, 8, 15, 6, 13, 4, 11, 2, 9};
+static const int md5_r4_shift[16] = {s41, s42, s43, s44, s41, s42, s43, s44, s41, s42, s43, s44, s41, s42, s43, s44};
+static const bit32 md5_r4_ac[16] = {
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+	0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+
+/**
+ * MD5Reverser: 只有少数几个目标时，对单block消息提前比对的破解器
+ * 单block消息的MD5就是初始state加上压缩函数的输出，所以从目标MD5减去初始state，
+ * 就可以沿着第64、63……步往回推，只要这一步用到的消息字对所有候选消息都相同
+ * 长度为L的消息中，满足4k >= L的字x[k]只有0x80和补的0，x[14]、x[15]是长度，它们都与消息内容无关
+ * 如果能推回到第K步之后的state，那么第K-3步写入的寄存器在之后的三步中不再改变，
+ * 正向只需要算到第K-3步就可以和目标比较：8个字节以内的消息在第53步比较，4个字节以内的在第46步，
+ * 更长的消息至少也能省下最后三步和最终MD5的转置
+ * 同一组通道必须在同一步停下，因此按长度而不是block数分组。通过比较的通道几乎都是真正的命中，
+ * 交给MD5Scheduler计算完整的MD5再确认
  */
-void MD5Hash(const string input[2], bit32 state[2][4])
+class MD5Reverser
 {
+public:
+	MD5Reverser(const MD5Backend &backend, const MD5TargetSet &targets, const MD5Output &output)
+		: backend(backend), scheduler(backend, output)
+	{
+		vector<bit32> digests = targets.list();
+		n_targets = digests.size() / 4;
+		// 任意一个长度为L的消息padding之后，与内容无关的那些字都相同，这里用全0的消息
+		const Byte msg[64] = {0};
+		for (int L = 0; L <= MD5_SINGLE_BLOCK; L += 1)
+		{
+			Byte buffer[64];
+			const Byte *block = MD5GetBlock(msg, L, 0, buffer);
+			bit32 x[16];
+			for (int k = 0; k < 16; k += 1)
+			{
+				x[k] = block[k * 4] | (block[k * 4 + 1] << 8) | (block[k * 4 + 2] << 16) | ((bit32)block[k * 4 + 3] << 24);
+			}
+			int K = 64;
+			while (K > 48 && (md5_r4_index[K - 49] >= 14 || md5_r4_index[K - 49] * 4 >= L))
+			{
+				K -= 1;
+			}
+			stop[L] = K - 3;
+			for (int t = 0; t < n_targets; t += 1)
+			{
+				bit32 r[4];
+				for (int k = 0; k < 4; k += 1)
+				{
+					r[k] = md5_bswap32(digests[t * 4 + k]) - md5_init_state[k];
+				}
+				for (int step = 64; step > K; step -= 1)
+				{
+					// 第step步写入的寄存器r[w]，以及这一步中作为b、c、d的寄存器
+					int i = step - 49;
+					int w = (4 - (step - 1) % 4) % 4;
+					bit32 b = r[(w + 1) % 4], c = r[(w + 2) % 4], d = r[(w + 3) % 4];
+					bit32 v = r[w] - b;
+					v = (v >> md5_r4_shift[i]) | (v << (32 - md5_r4_shift[i]));
+					r[w] = v - (c ^ (b | ~d)) - x[md5_r4_index[i]] - md5_r4_ac[i];
+				}
+				target[L][t] = r[(4 - (stop[L] - 1) % 4) % 4];
+			}
+			pending[L] = 0;
+		}
+	}
 
-	Byte* paddedMessage1, * paddedMessage2;
-	int* messageLength1 = new int[1];
-	for (int i = 0; i < 1; i += 1)
+	// 加入一个消息，超过一个block的消息直接交给MD5Scheduler
+	void push(const MD5Lane &msg)
 	{
-		paddedMessage1 = StringProcess(input[0], &messageLength1[i]);
-		// cout<<messageLength[i]<<endl;
-		assert(messageLength1[i] == messageLength1[0]);
+		if (msg.length > MD5_SINGLE_BLOCK)
+		{
+			scheduler.push(msg);
+			return;
+		}
+		int L = (int)msg.length;
+		buckets[L][pending[L]] = msg;
+		pending[L] += 1;
+		if (pending[L] == backend.lanes)
+		{
+			run(L);
+		}
 	}
-	int n_blocks1 = messageLength1[0] / 64;
 
-	int* messageLength2 = new int[1];
-	for (int i = 0; i < 1; i += 1)
+	// 计算所有剩余的消息
+	void flush()
 	{
-		paddedMessage2 = StringProcess(input[1], &messageLength2[i]);
-		// cout<<messageLength[i]<<endl;
-		assert(messageLength2[i] == messageLength2[0]);
+		for (int L = 0; L <= MD5_SINGLE_BLOCK; L += 1)
+		{
+			if (pending[L] > 0)
+			{
+				run(L);
+			}
+		}
+		scheduler.flush();
 	}
-	int n_blocks2 = messageLength2[0] / 64;
 
-	
-	// bit32* state= new bit32[4];
-	for (int kk = 0; kk < 2; kk++)
+private:
+	// 比较长度为L的一组消息，通过的交给scheduler
+	void run(int L)
 	{
-		state[kk][0] = 0x67452301;
-		state[kk][1] = 0xefcdab89;
-		state[kk][2] = 0x98badcfe;
-		state[kk][3] = 0x10325476;
+		const Byte *block[MD5_MAX_LANES] = {};
+		for (int l = 0; l < backend.lanes; l += 1)
+		{
+			block[l] = MD5LaneBlock(l < pending[L] ? &buckets[L][l] : NULL, 0, buffer[l]);
+		}
+		unsigned pass = backend.reverse(block, stop[L], target[L], n_targets);
+		for (int l = 0; l < pending[L]; l += 1)
+		{
+			if (pass >> l & 1)
+			{
+				scheduler.push(buckets[L][l]);
+			}
+		}
+		pending[L] = 0;
 	}
 
-	//找出最小块数
-	int aaa[2] = { n_blocks1,n_blocks2};
-	int min_n_blocks = aaa[0]>aaa[1]?aaa[1]:aaa[0];
-	
-	bit32 x[2][16];
-	// 逐block地更新state
-	for (int i = 0; i < min_n_blocks; i += 1)
-	{
-		// 下面的处理，在理解上较为复杂
-		for (int i1 = 0; i1 < 16; ++i1)
-		{
-			x[0][i1] = (paddedMessage1[4 * i1 + i * 64]) |
-				(paddedMessage1[4 * i1 + 1 + i * 64] << 8) |
-				(paddedMessage1[4 * i1 + 2 + i * 64] << 16) |
-				(paddedMessage1[4 * i1 + 3 + i * 64] << 24);
-		}
-		for (int i1 = 0; i1 < 16; ++i1)
-		{
-			x[1][i1] = (paddedMessage2[4 * i1 + i * 64]) |
-				(paddedMessage2[4 * i1 + 1 + i * 64] << 8) |
-				(paddedMessage2[4 * i1 + 2 + i * 64] << 16) |
-				(paddedMessage2[4 * i1 + 3 + i * 64] << 24);
-		}
-		
-
-		uint32_t a_values[2] = { state[0][0],state[1][0] };
-		uint32_t b_values[2] = { state[0][1],state[1][1]};
-		uint32_t c_values[2] = { state[0][2],state[1][2]};
-		uint32_t d_values[2] = { state[0][3],state[1][3]};
-
-		uint32x2_t va = vld1_u32(a_values);
-		uint32x2_t vb = vld1_u32(b_values);
-		uint32x2_t vc = vld1_u32(c_values);
-		uint32x2_t vd = vld1_u32(d_values);
-
-		uint32_t x0_values[2] = { x[0][0],x[1][0] };
-		uint32_t x1_values[2] = { x[0][1],x[1][1] };
-		uint32_t x2_values[2] = { x[0][2],x[1][2] };
-		uint32_t x3_values[2] = { x[0][3],x[1][3] };
-		uint32_t x4_values[2] = { x[0][4],x[1][4] };
-		uint32_t x5_values[2] = { x[0][5],x[1][5] };
-		uint32_t x6_values[2] = { x[0][6],x[1][6]};
-		uint32_t x7_values[2] = { x[0][7],x[1][7] };
-		uint32_t x8_values[2] = { x[0][8],x[1][8] };
-		uint32_t x9_values[2] = { x[0][9],x[1][9] };
-		uint32_t x10_values[2] = { x[0][10],x[1][10] };
-		uint32_t x11_values[2] = { x[0][11],x[1][11] };
-		uint32_t x12_values[2] = { x[0][12],x[1][12] };
-		uint32_t x13_values[2] = { x[0][13],x[1][13] };
-		uint32_t x14_values[2] = { x[0][14],x[1][14] };
-		uint32_t x15_values[2] = { x[0][15],x[1][15] };
-
-		uint32x2_t x0 = vld1_u32(x0_values);
-		uint32x2_t x1 = vld1_u32(x1_values);
-		uint32x2_t x2 = vld1_u32(x2_values);
-		uint32x2_t x3 = vld1_u32(x3_values);
-		uint32x2_t x4 = vld1_u32(x4_values);
-		uint32x2_t x5 = vld1_u32(x5_values);
-		uint32x2_t x6 = vld1_u32(x6_values);
-		uint32x2_t x7 = vld1_u32(x7_values);
-		uint32x2_t x8 = vld1_u32(x8_values);
-		uint32x2_t x9 = vld1_u32(x9_values);
-		uint32x2_t x10 = vld1_u32(x10_values);
-		uint32x2_t x11 = vld1_u32(x11_values);
-		uint32x2_t x12 = vld1_u32(x12_values);
-		uint32x2_t x13 = vld1_u32(x13_values);
-		uint32x2_t x14 = vld1_u32(x14_values);
-		uint32x2_t x15 = vld1_u32(x15_values);
-
-
-		auto start = system_clock::now();
-		/* Round 1 */
-		va = FF(va, vb, vc, vd, x0, s11, 0xd76aa478);
-		vd = FF(vd, va, vb, vc, x1, s12, 0xe8c7b756);
-		vc = FF(vc, vd, va, vb, x2, s13, 0x242070db);
-		vb = FF(vb, vc, vd, va, x3, s14, 0xc1bdceee);
-		va = FF(va, vb, vc, vd, x4, s11, 0xf57c0faf);
-		vd = FF(vd, va, vb, vc, x5, s12, 0x4787c62a);
-		vc = FF(vc, vd, va, vb, x6, s13, 0xa8304613);
-		vb = FF(vb, vc, vd, va, x7, s14, 0xfd469501);
-		va = FF(va, vb, vc, vd, x8, s11, 0x698098d8);
-		vd = FF(vd, va, vb, vc, x9, s12, 0x8b44f7af);
-		vc = FF(vc, vd, va, vb, x10, s13, 0xffff5bb1);
-		vb = FF(vb, vc, vd, va, x11, s14, 0x895cd7be);
-		va = FF(va, vb, vc, vd, x12, s11, 0x6b901122);
-		vd = FF(vd, va, vb, vc, x13, s12, 0xfd987193);
-		vc = FF(vc, vd, va, vb, x14, s13, 0xa679438e);
-		vb = FF(vb, vc, vd, va, x15, s14, 0x49b40821);
-
-		/* Round 2 */
-		va = GG(va, vb, vc, vd, x1, s21, 0xf61e2562);
-		vd = GG(vd, va, vb, vc, x6, s22, 0xc040b340);
-		vc = GG(vc, vd, va, vb, x11, s23, 0x265e5a51);
-		vb = GG(vb, vc, vd, va, x0, s24, 0xe9b6c7aa);
-		va = GG(va, vb, vc, vd, x5, s21, 0xd62f105d);
-		vd = GG(vd, va, vb, vc, x10, s22, 0x2441453);
-		vc = GG(vc, vd, va, vb, x15, s23, 0xd8a1e681);
-		vb = GG(vb, vc, vd, va, x4, s24, 0xe7d3fbc8);
-		va = GG(va, vb, vc, vd, x9, s21, 0x21e1cde6);
-		vd = GG(vd, va, vb, vc, x14, s22, 0xc33707d6);
-		vc = GG(vc, vd, va, vb, x3, s23, 0xf4d50d87);
-		vb = GG(vb, vc, vd, va, x8, s24, 0x455a14ed);
-		va = GG(va, vb, vc, vd, x13, s21, 0xa9e3e905);
-		vd = GG(vd, va, vb, vc, x2, s22, 0xfcefa3f8);
-		vc = GG(vc, vd, va, vb, x7, s23, 0x676f02d9);
-		vb = GG(vb, vc, vd, va, x12, s24, 0x8d2a4c8a);
-
-		/* Round 3 */
-		va = HH(va, vb, vc, vd, x5, s31, 0xfffa3942);
-		vd = HH(vd, va, vb, vc, x8, s32, 0x8771f681);
-		vc = HH(vc, vd, va, vb, x11, s33, 0x6d9d6122);
-		vb = HH(vb, vc, vd, va, x14, s34, 0xfde5380c);
-		va = HH(va, vb, vc, vd, x1, s31, 0xa4beea44);
-		vd = HH(vd, va, vb, vc, x4, s32, 0x4bdecfa9);
-		vc = HH(vc, vd, va, vb, x7, s33, 0xf6bb4b60);
-		vb = HH(vb, vc, vd, va, x10, s34, 0xbebfbc70);
-		va = HH(va, vb, vc, vd, x13, s31, 0x289b7ec6);
-		vd = HH(vd, va, vb, vc, x0, s32, 0xeaa127fa);
-		vc = HH(vc, vd, va, vb, x3, s33, 0xd4ef3085);
-		vb = HH(vb, vc, vd, va, x6, s34, 0x4881d05);
-		va = HH(va, vb, vc, vd, x9, s31, 0xd9d4d039);
-		vd = HH(vd, va, vb, vc, x12, s32, 0xe6db99e5);
-		vc = HH(vc, vd, va, vb, x15, s33, 0x1fa27cf8);
-		vb = HH(vb, vc, vd, va, x2, s34, 0xc4ac5665);
-
-		/* Round 4 */
-		va = II(va, vb, vc, vd, x0, s41, 0xf4292244);
-		vd = II(vd, va, vb, vc, x7, s42, 0x432aff97);
-		vc = II(vc, vd, va, vb, x14, s43, 0xab9423a7);
-		vb = II(vb, vc, vd, va, x5, s44, 0xfc93a039);
-		va = II(va, vb, vc, vd, x12, s41, 0x655b59c3);
-		vd = II(vd, va, vb, vc, x3, s42, 0x8f0ccc92);
-		vc = II(vc, vd, va, vb, x10, s43, 0xffeff47d);
-		vb = II(vb, vc, vd, va, x1, s44, 0x85845dd1);
-		va = II(va, vb, vc, vd, x8, s41, 0x6fa87e4f);
-		vd = II(vd, va, vb, vc, x15, s42, 0xfe2ce6e0);
-		vc = II(vc, vd, va, vb, x6, s43, 0xa3014314);
-		vb = II(vb, vc, vd, va, x13, s44, 0x4e0811a1);
-		va = II(va, vb, vc, vd, x4, s41, 0xf7537e82);
-		vd = II(vd, va, vb, vc, x11, s42, 0xbd3af235);
-		vc = II(vc, vd, va, vb, x2, s43, 0x2ad7d2bb);
-		vb = II(vb, vc, vd, va, x9, s44, 0xeb86d391);
-
-		state[0][0] += vget_lane_u32(va, 0);
-		state[0][1] += vget_lane_u32(vb, 0);
-		state[0][2] += vget_lane_u32(vc, 0);
-		state[0][3] += vget_lane_u32(vd, 0);
-		state[1][0] += vget_lane_u32(va, 1);
-		state[1][1] += vget_lane_u32(vb, 1);
-		state[1][2] += vget_lane_u32(vc, 1);
-		state[1][3] += vget_lane_u32(vd, 1);
-		
-	}
-	if (n_blocks1 > min_n_blocks)
-	{
-		for (int i = min_n_blocks; i < n_blocks1; i += 1)
-		{
-			for (int i1 = 0; i1 < 16; ++i1)
+	const MD5Backend &backend;
+	int n_targets;
+	// stop[L]: 长度为L的消息正向计算到第几步；target[L][t]: 第t个目标在这一步写入的寄存器的值
+	int stop[MD5_SINGLE_BLOCK + 1];
+	bit32 target[MD5_SINGLE_BLOCK + 1][MD5_REVERSE_TARGETS];
+	MD5Lane buckets[MD5_SINGLE_BLOCK + 1][MD5_MAX_LANES];
+	int pending[MD5_SINGLE_BLOCK + 1];
+	Byte buffer[MD5_MAX_LANES][64];
+	MD5Scheduler scheduler;
+};
+
+// 第一轮各步的循环左移位数和常数，用于在标量上计算共享前缀的部分
+static const int md5_r1_shift[4] = {s11, s12, s13, s14};
+static const bit32 md5_r1_ac[16] = {
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+	0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821};
+
+/**
+ * MD5PrefixMid: 在标量上算出第一轮的前start步，结果供共享这段前缀的所有消息使用
+ * @param msg 前缀，至少有start * 4个字节
+ * @param[out] mid 前start步之后的a、b、c、d
+ */
+static void MD5PrefixMid(const Byte *msg, int start, bit32 mid[4])
+{
+	memcpy(mid, md5_init_state, sizeof(md5_init_state));
+	for (int i = 0; i < start; i += 1)
+	{
+		// 第i+1步写入的寄存器mid[w]，以及这一步中作为b、c、d的寄存器
+		int w = (4 - i % 4) % 4;
+		bit32 b = mid[(w + 1) % 4], c = mid[(w + 2) % 4], d = mid[(w + 3) % 4];
+		bit32 x = msg[i * 4] | (msg[i * 4 + 1] << 8) | (msg[i * 4 + 2] << 16) | ((bit32)msg[i * 4 + 3] << 24);
+		bit32 v = mid[w] + ((b & c) | (~b & d)) + x + md5_r1_ac[i];
+		mid[w] = b + ((v << md5_r1_shift[i % 4]) | (v >> (32 - md5_r1_shift[i % 4])));
+	}
+}
+
+void MD5Hash(const string input[], bit32 state[][4], size_t n)
+{
+	MD5Input in = {input, NULL, NULL};
+	MD5HashInput(in, state, n);
+}
+
+void MD5Hash(const char *data, const size_t offsets[], bit32 state[][4], size_t n)
+{
+	MD5Input in = {NULL, data, offsets};
+	MD5HashInput(in, state, n);
+}
+
+void MD5HashSuffixes(const string &prefix, const string values[], bit32 state[][4], size_t n)
+{
+	if (n == 0)
+	{
+		return;
+	}
+	const MD5Backend &backend = *MD5CurrentBackend();
+	const int lanes = backend.lanes;
+	const size_t prefix_len = prefix.length();
+	const size_t suffix_len = values[0].length();
+	const size_t length = prefix_len + suffix_len;
+	MD5Output output = {NULL, NULL};
+	MD5Lane group[MD5_MAX_LANES];
+
+	if (length > MD5_SINGLE_BLOCK)
+	{
+		// 多个block的消息很少见：每个通道拼出完整的消息，padding仍由MD5GetBlock完成
+		vector<Byte> joined(lanes * length);
+		for (int l = 0; l < lanes; l += 1)
+		{
+			memcpy(&joined[l * length], prefix.data(), prefix_len);
+		}
+		for (size_t i = 0; i < n; i += lanes)
+		{
+			int m = (int)min((size_t)lanes, n - i);
+			for (int l = 0; l < m; l += 1)
 			{
-				x[0][i1] = (paddedMessage1[4 * i1 + i * 64]) |
-					(paddedMessage1[4 * i1 + 1 + i * 64] << 8) |
-					(paddedMessage1[4 * i1 + 2 + i * 64] << 16) |
-					(paddedMessage1[4 * i1 + 3 + i * 64] << 24);
+				assert(values[i + l].length() == suffix_len);
+				memcpy(&joined[l * length + prefix_len], values[i + l].data(), suffix_len);
+				group[l] = {&joined[l * length], length, state[i + l], i + l};
 			}
-			uint32x2_t va = vdup_n_u32(state[0][0]);
-			uint32x2_t vb = vdup_n_u32(state[0][1]);
-			uint32x2_t vc = vdup_n_u32(state[0][2]);
-			uint32x2_t vd = vdup_n_u32(state[0][3]);
-			uint32x2_t x0 = vdup_n_u32(x[0][0]);
-			uint32x2_t x1 = vdup_n_u32(x[0][1]);
-			uint32x2_t x2 = vdup_n_u32(x[0][2]);
-			uint32x2_t x3 = vdup_n_u32(x[0][3]);
-			uint32x2_t x4 = vdup_n_u32(x[0][4]);
-			uint32x2_t x5 = vdup_n_u32(x[0][5]);
-			uint32x2_t x6 = vdup_n_u32(x[0][6]);
-			uint32x2_t x7 = vdup_n_u32(x[0][7]);
-			uint32x2_t x8 = vdup_n_u32(x[0][8]);
-			uint32x2_t x9 = vdup_n_u32(x[0][9]);
-			uint32x2_t x10 = vdup_n_u32(x[0][10]);
-			uint32x2_t x11 = vdup_n_u32(x[0][11]);
-			uint32x2_t x12 = vdup_n_u32(x[0][12]);
-			uint32x2_t x13 = vdup_n_u32(x[0][13]);
-			uint32x2_t x14 = vdup_n_u32(x[0][14]);
-			uint32x2_t x15 = vdup_n_u32(x[0][15]);
-			va = FF(va, vb, vc, vd, x0, s11, 0xd76aa478);
-			vd = FF(vd, va, vb, vc, x1, s12, 0xe8c7b756);
-			vc = FF(vc, vd, va, vb, x2, s13, 0x242070db);
-			vb = FF(vb, vc, vd, va, x3, s14, 0xc1bdceee);
-			va = FF(va, vb, vc, vd, x4, s11, 0xf57c0faf);
-			vd = FF(vd, va, vb, vc, x5, s12, 0x4787c62a);
-			vc = FF(vc, vd, va, vb, x6, s13, 0xa8304613);
-			vb = FF(vb, vc, vd, va, x7, s14, 0xfd469501);
-			va = FF(va, vb, vc, vd, x8, s11, 0x698098d8);
-			vd = FF(vd, va, vb, vc, x9, s12, 0x8b44f7af);
-			vc = FF(vc, vd, va, vb, x10, s13, 0xffff5bb1);
-			vb = FF(vb, vc, vd, va, x11, s14, 0x895cd7be);
-			va = FF(va, vb, vc, vd, x12, s11, 0x6b901122);
-			vd = FF(vd, va, vb, vc, x13, s12, 0xfd987193);
-			vc = FF(vc, vd, va, vb, x14, s13, 0xa679438e);
-			vb = FF(vb, vc, vd, va, x15, s14, 0x49b40821);
-
-			/* Round 2 */
-			va = GG(va, vb, vc, vd, x1, s21, 0xf61e2562);
-			vd = GG(vd, va, vb, vc, x6, s22, 0xc040b340);
-			vc = GG(vc, vd, va, vb, x11, s23, 0x265e5a51);
-			vb = GG(vb, vc, vd, va, x0, s24, 0xe9b6c7aa);
-			va = GG(va, vb, vc, vd, x5, s21, 0xd62f105d);
-			vd = GG(vd, va, vb, vc, x10, s22, 0x2441453);
-			vc = GG(vc, vd, va, vb, x15, s23, 0xd8a1e681);
-			vb = GG(vb, vc, vd, va, x4, s24, 0xe7d3fbc8);
-			va = GG(va, vb, vc, vd, x9, s21, 0x21e1cde6);
-			vd = GG(vd, va, vb, vc, x14, s22, 0xc33707d6);
-			vc = GG(vc, vd, va, vb, x3, s23, 0xf4d50d87);
-			vb = GG(vb, vc, vd, va, x8, s24, 0x455a14ed);
-			va = GG(va, vb, vc, vd, x13, s21, 0xa9e3e905);
-			vd = GG(vd, va, vb, vc, x2, s22, 0xfcefa3f8);
-			vc = GG(vc, vd, va, vb, x7, s23, 0x676f02d9);
-			vb = GG(vb, vc, vd, va, x12, s24, 0x8d2a4c8a);
-
-			/* Round 3 */
-			va = HH(va, vb, vc, vd, x5, s31, 0xfffa3942);
-			vd = HH(vd, va, vb, vc, x8, s32, 0x8771f681);
-			vc = HH(vc, vd, va, vb, x11, s33, 0x6d9d6122);
-			vb = HH(vb, vc, vd, va, x14, s34, 0xfde5380c);
-			va = HH(va, vb, vc, vd, x1, s31, 0xa4beea44);
-			vd = HH(vd, va, vb, vc, x4, s32, 0x4bdecfa9);
-			vc = HH(vc, vd, va, vb, x7, s33, 0xf6bb4b60);
-			vb = HH(vb, vc, vd, va, x10, s34, 0xbebfbc70);
-			va = HH(va, vb, vc, vd, x13, s31, 0x289b7ec6);
-			vd = HH(vd, va, vb, vc, x0, s32, 0xeaa127fa);
-			vc = HH(vc, vd, va, vb, x3, s33, 0xd4ef3085);
-			vb = HH(vb, vc, vd, va, x6, s34, 0x4881d05);
-			va = HH(va, vb, vc, vd, x9, s31, 0xd9d4d039);
-			vd = HH(vd, va, vb, vc, x12, s32, 0xe6db99e5);
-			vc = HH(vc, vd, va, vb, x15, s33, 0x1fa27cf8);
-			vb = HH(vb, vc, vd, va, x2, s34, 0xc4ac5665);
-
-			/* Round 4 */
-			va = II(va, vb, vc, vd, x0, s41, 0xf4292244);
-			vd = II(vd, va, vb, vc, x7, s42, 0x432aff97);
-			vc = II(vc, vd, va, vb, x14, s43, 0xab9423a7);
-			vb = II(vb, vc, vd, va, x5, s44, 0xfc93a039);
-			va = II(va, vb, vc, vd, x12, s41, 0x655b59c3);
-			vd = II(vd, va, vb, vc, x3, s42, 0x8f0ccc92);
-			vc = II(vc, vd, va, vb, x10, s43, 0xffeff47d);
-			vb = II(vb, vc, vd, va, x1, s44, 0x85845dd1);
-			va = II(va, vb, vc, vd, x8, s41, 0x6fa87e4f);
-			vd = II(vd, va, vb, vc, x15, s42, 0xfe2ce6e0);
-			vc = II(vc, vd, va, vb, x6, s43, 0xa3014314);
-			vb = II(vb, vc, vd, va, x13, s44, 0x4e0811a1);
-			va = II(va, vb, vc, vd, x4, s41, 0xf7537e82);
-			vd = II(vd, va, vb, vc, x11, s42, 0xbd3af235);
-			vc = II(vc, vd, va, vb, x2, s43, 0x2ad7d2bb);
-			vb = II(vb, vc, vd, va, x9, s44, 0xeb86d391);
-
-			state[0][0] += vget_lane_u32(va, 0);
-			state[0][1] += vget_lane_u32(vb, 0);
-			state[0][2] += vget_lane_u32(vc, 0);
-			state[0][3] += vget_lane_u32(vd, 0);
-		}
-	}
-
-	if (n_blocks2 > min_n_blocks)
-	{
-		for (int i = min_n_blocks; i < n_blocks2; i += 1)
-		{
-			for (int i1 = 0; i1 < 16; ++i1)
+			MD5HashLanes(backend, group, m, MD5BlockCount(length), output);
+		}
+		return;
+	}
+
+	// 每个通道一个padding好的block模板：前缀、0x80和消息长度只写一次，之后每个消息只复制value的几个字节
+	Byte block_buffer[MD5_MAX_LANES][64];
+	const Byte *block[MD5_MAX_LANES];
+	memset(block_buffer[0], 0, 64);
+	memcpy(block_buffer[0], prefix.data(), prefix_len);
+	block_buffer[0][length] = 0x80;
+	for (int k = 0; k < 8; ++k)
+	{
+		block_buffer[0][56 + k] = ((uint64_t)length * 8 >> (k * 8)) & 0xFF;
+	}
+	for (int l = 0; l < lanes; l += 1)
+	{
+		memcpy(block_buffer[l], block_buffer[0], 64);
+		block[l] = block_buffer[l];
+	}
+	// 第一轮的第k步只用到x[k]，前缀中完整的消息字对应的各步所有消息都相同，只在标量上算一次，再广播给所有通道
+	int start = (int)(prefix_len / 4);
+	bit32 mid[4];
+	MD5PrefixMid(block_buffer[0], start, mid);
+
+	bit32 lane_state[4 * MD5_MAX_LANES];
+	for (size_t i = 0; i < n; i += lanes)
+	{
+		// 最后一组中没有用到的通道保留上一组的内容，结果不会被输出
+		int m = (int)min((size_t)lanes, n - i);
+		for (int l = 0; l < m; l += 1)
+		{
+			// 长度不同的value会写错padding的位置，或越过block的末尾
+			assert(values[i + l].length() == suffix_len);
+			memcpy(block_buffer[l] + prefix_len, values[i + l].data(), suffix_len);
+			group[l] = {block_buffer[l], length, state[i + l], i + l};
+		}
+		for (int k = 0; k < 4; k += 1)
+		{
+			for (int l = 0; l < lanes; l += 1)
 			{
-				x[1][i1] = (paddedMessage2[4 * i1 + i * 64]) |
-					(paddedMessage2[4 * i1 + 1 + i * 64] << 8) |
-					(paddedMessage2[4 * i1 + 2 + i * 64] << 16) |
-					(paddedMessage2[4 * i1 + 3 + i * 64] << 24);
+				lane_state[k * lanes + l] = md5_init_state[k];
 			}
-			uint32x2_t va = vdup_n_u32(state[1][0]);
-			uint32x2_t vb = vdup_n_u32(state[1][1]);
-			uint32x2_t vc = vdup_n_u32(state[1][2]);
-			uint32x2_t vd = vdup_n_u32(state[1][3]);
-			uint32x2_t x0 = vdup_n_u32(x[1][0]);
-			uint32x2_t x1 = vdup_n_u32(x[1][1]);
-			uint32x2_t x2 = vdup_n_u32(x[1][2]);
-			uint32x2_t x3 = vdup_n_u32(x[1][3]);
-			uint32x2_t x4 = vdup_n_u32(x[1][4]);
-			uint32x2_t x5 = vdup_n_u32(x[1][5]);
-			uint32x2_t x6 = vdup_n_u32(x[1][6]);
-			uint32x2_t x7 = vdup_n_u32(x[1][7]);
-			uint32x2_t x8 = vdup_n_u32(x[1][8]);
-			uint32x2_t x9 = vdup_n_u32(x[1][9]);
-			uint32x2_t x10 = vdup_n_u32(x[1][10]);
-			uint32x2_t x11 = vdup_n_u32(x[1][11]);
-			uint32x2_t x12 = vdup_n_u32(x[1][12]);
-			uint32x2_t x13 = vdup_n_u32(x[1][13]);
-			uint32x2_t x14 = vdup_n_u32(x[1][14]);
-			uint32x2_t x15 = vdup_n_u32(x[1][15]);
-
-			va = FF(va, vb, vc, vd, x0, s11, 0xd76aa478);
-			vd = FF(vd, va, vb, vc, x1, s12, 0xe8c7b756);
-			vc = FF(vc, vd, va, vb, x2, s13, 0x242070db);
-			vb = FF(vb, vc, vd, va, x3, s14, 0xc1bdceee);
-			va = FF(va, vb, vc, vd, x4, s11, 0xf57c0faf);
-			vd = FF(vd, va, vb, vc, x5, s12, 0x4787c62a);
-			vc = FF(vc, vd, va, vb, x6, s13, 0xa8304613);
-			vb = FF(vb, vc, vd, va, x7, s14, 0xfd469501);
-			va = FF(va, vb, vc, vd, x8, s11, 0x698098d8);
-			vd = FF(vd, va, vb, vc, x9, s12, 0x8b44f7af);
-			vc = FF(vc, vd, va, vb, x10, s13, 0xffff5bb1);
-			vb = FF(vb, vc, vd, va, x11, s14, 0x895cd7be);
-			va = FF(va, vb, vc, vd, x12, s11, 0x6b901122);
-			vd = FF(vd, va, vb, vc, x13, s12, 0xfd987193);
-			vc = FF(vc, vd, va, vb, x14, s13, 0xa679438e);
-			vb = FF(vb, vc, vd, va, x15, s14, 0x49b40821);
-
-			/* Round 2 */
-			va = GG(va, vb, vc, vd, x1, s21, 0xf61e2562);
-			vd = GG(vd, va, vb, vc, x6, s22, 0xc040b340);
-			vc = GG(vc, vd, va, vb, x11, s23, 0x265e5a51);
-			vb = GG(vb, vc, vd, va, x0, s24, 0xe9b6c7aa);
-			va = GG(va, vb, vc, vd, x5, s21, 0xd62f105d);
-			vd = GG(vd, va, vb, vc, x10, s22, 0x2441453);
-			vc = GG(vc, vd, va, vb, x15, s23, 0xd8a1e681);
-			vb = GG(vb, vc, vd, va, x4, s24, 0xe7d3fbc8);
-			va = GG(va, vb, vc, vd, x9, s21, 0x21e1cde6);
-			vd = GG(vd, va, vb, vc, x14, s22, 0xc33707d6);
-			vc = GG(vc, vd, va, vb, x3, s23, 0xf4d50d87);
-			vb = GG(vb, vc, vd, va, x8, s24, 0x455a14ed);
-			va = GG(va, vb, vc, vd, x13, s21, 0xa9e3e905);
-			vd = GG(vd, va, vb, vc, x2, s22, 0xfcefa3f8);
-			vc = GG(vc, vd, va, vb, x7, s23, 0x676f02d9);
-			vb = GG(vb, vc, vd, va, x12, s24, 0x8d2a4c8a);
-
-			/* Round 3 */
-			va = HH(va, vb, vc, vd, x5, s31, 0xfffa3942);
-			vd = HH(vd, va, vb, vc, x8, s32, 0x8771f681);
-			vc = HH(vc, vd, va, vb, x11, s33, 0x6d9d6122);
-			vb = HH(vb, vc, vd, va, x14, s34, 0xfde5380c);
-			va = HH(va, vb, vc, vd, x1, s31, 0xa4beea44);
-			vd = HH(vd, va, vb, vc, x4, s32, 0x4bdecfa9);
-			vc = HH(vc, vd, va, vb, x7, s33, 0xf6bb4b60);
-			vb = HH(vb, vc, vd, va, x10, s34, 0xbebfbc70);
-			va = HH(va, vb, vc, vd, x13, s31, 0x289b7ec6);
-			vd = HH(vd, va, vb, vc, x0, s32, 0xeaa127fa);
-			vc = HH(vc, vd, va, vb, x3, s33, 0xd4ef3085);
-			vb = HH(vb, vc, vd, va, x6, s34, 0x4881d05);
-			va = HH(va, vb, vc, vd, x9, s31, 0xd9d4d039);
-			vd = HH(vd, va, vb, vc, x12, s32, 0xe6db99e5);
-			vc = HH(vc, vd, va, vb, x15, s33, 0x1fa27cf8);
-			vb = HH(vb, vc, vd, va, x2, s34, 0xc4ac5665);
-
-			/* Round 4 */
-			va = II(va, vb, vc, vd, x0, s41, 0xf4292244);
-			vd = II(vd, va, vb, vc, x7, s42, 0x432aff97);
-			vc = II(vc, vd, va, vb, x14, s43, 0xab9423a7);
-			vb = II(vb, vc, vd, va, x5, s44, 0xfc93a039);
-			va = II(va, vb, vc, vd, x12, s41, 0x655b59c3);
-			vd = II(vd, va, vb, vc, x3, s42, 0x8f0ccc92);
-			vc = II(vc, vd, va, vb, x10, s43, 0xffeff47d);
-			vb = II(vb, vc, vd, va, x1, s44, 0x85845dd1);
-			va = II(va, vb, vc, vd, x8, s41, 0x6fa87e4f);
-			vd = II(vd, va, vb, vc, x15, s42, 0xfe2ce6e0);
-			vc = II(vc, vd, va, vb, x6, s43, 0xa3014314);
-			vb = II(vb, vc, vd, va, x13, s44, 0x4e0811a1);
-			va = II(va, vb, vc, vd, x4, s41, 0xf7537e82);
-			vd = II(vd, va, vb, vc, x11, s42, 0xbd3af235);
-			vc = II(vc, vd, va, vb, x2, s43, 0x2ad7d2bb);
-			vb = II(vb, vc, vd, va, x9, s44, 0xeb86d391);
-
-			state[1][0] += vget_lane_u32(va, 0);
-			state[1][1] += vget_lane_u32(vb, 0);
-			state[1][2] += vget_lane_u32(vc, 0);
-			state[1][3] += vget_lane_u32(vd, 0);
-		}
-	}
-	
-	// 下面的处理，在理解上较为复杂
-	for (int i = 0; i < 4; i++)
-	{
-		uint32_t value = state[0][i];
-		state[0][i] = ((value & 0xff) << 24) |		 // 将最低字节移到最高位
-			((value & 0xff00) << 8) |	 // 将次低字节左移
-			((value & 0xff0000) >> 8) |	 // 将次高字节右移
-			((value & 0xff000000) >> 24); // 将最高字节移到最低位
-	}
-	for (int i = 0; i < 4; i++)
-	{
-		uint32_t value = state[1][i];
-		state[1][i] = ((value & 0xff) << 24) |		 // 将最低字节移到最高位
-			((value & 0xff00) << 8) |	 // 将次低字节左移
-			((value & 0xff0000) >> 8) |	 // 将次高字节右移
-			((value & 0xff000000) >> 24); // 将最高字节移到最低位
-	}
-	
-	// 输出最终的hash结果
-	// for (int i1 = 0; i1 < 4; i1 += 1)
-	// {
-	// 	cout << std::setw(8) << std::setfill('0') << hex << state[i1];
-	// }
-	// cout << endl;
-
-	// 释放动态分配的内存
-	// 实现SIMD并行算法的时候，也请记得及时回收内存！
-	delete[] paddedMessage1;
-	delete[] paddedMessage2;
-	
-	delete[] messageLength1;
-	delete[] messageLength2;
-	
-}
\ No newline at end of file
+		}
+		if (start > 0)
+		{
+			backend.compress_prefix(lane_state, mid, start, block);
+		}
+		else
+		{
+			backend.compress(lane_state, block);
+		}
+		MD5FinishLanes(backend, lane_state, group, (1u << m) - 1, output);
+	}
+}
+
+static size_t MD5CrackInput(const MD5Input &input, size_t n, const MD5TargetSet &targets, vector<size_t> &hits)
+{
+	if (targets.size() == 0)
+	{
+		return 0;
+	}
+	size_t n_hits = hits.size();
+	MD5Output output = {&targets, &hits};
+	if (targets.size() <= MD5_REVERSE_TARGETS)
+	{
+		MD5Reverser reverser(*MD5CurrentBackend(), targets, output);
+		for (size_t i = 0; i < n; i += 1)
+		{
+			MD5Lane lane = {input.msg(i), input.length(i), NULL, i};
+			reverser.push(lane);
+		}
+		reverser.flush();
+	}
+	else
+	{
+		MD5Scheduler scheduler(*MD5CurrentBackend(), output);
+		for (size_t i = 0; i < n; i += 1)
+		{
+			MD5Lane lane = {input.msg(i), input.length(i), NULL, i};
+			scheduler.push(lane);
+		}
+		scheduler.flush();
+	}
+	return hits.size() - n_hits;
+}
+
+size_t MD5Crack(const string input[], size_t n, const MD5TargetSet &targets, vector<size_t> &hits)
+{
+	MD5Input in = {input, NULL, NULL};
+	return MD5CrackInput(in, n, targets, hits);
+}
+
+size_t MD5Crack(const char *data, const size_t offsets[], size_t n, const MD5TargetSet &targets, vector<size_t> &hits)
+{
+	MD5Input in = {NULL, data, offsets};
+	return MD5CrackInput(in, n, targets, hits);
+}
+
+// 哈希表的位置：MD5本身就是均匀分布的，直接取第二个字（第一个字已经用于位图）
+static inline size_t MD5TargetSlot(const bit32 digest[4], size_t mask)
+{
+	return digest[1] & mask;
+}
+
+/**
+ * rebuild: 把哈希表扩大到capacity个表项，并按新的目标数重新确定位图的大小
+ * 位图每个目标约占8位，这样随机的MD5通过过滤的概率不超过1/8
+ */
+void MD5TargetSet::rebuild(size_t capacity)
+{
+	vector<bit32> old;
+	old.swap(table);
+	table.assign(capacity * 4, 0);
+	mask = capacity - 1;
+
+	int bits = 16;
+	while (bits < 28 && ((size_t)1 << bits) < capacity * 8)
+	{
+		bits += 1;
+	}
+	bitmap.assign(((size_t)1 << bits) / 32, 0);
+	bitmap_shift = 32 - bits;
+
+	for (size_t i = 0; i < old.size(); i += 4)
+	{
+		const bit32 *digest = &old[i];
+		if ((digest[0] | digest[1] | digest[2] | digest[3]) == 0)
+		{
+			continue;
+		}
+		size_t slot = MD5TargetSlot(digest, mask);
+		while (table[slot * 4] | table[slot * 4 + 1] | table[slot * 4 + 2] | table[slot * 4 + 3])
+		{
+			slot = (slot + 1) & mask;
+		}
+		memcpy(&table[slot * 4], digest, 16);
+		bit32 bit = md5_bswap32(digest[0]) >> bitmap_shift;
+		bitmap[bit >> 5] |= 1u << (bit & 31);
+	}
+	if (has_zero)
+	{
+		bitmap[0] |= 1;
+	}
+}
+
+void MD5TargetSet::insert(const bit32 digest[4])
+{
+	// 负载因子不超过1/2，线性探测的平均探测长度很短
+	if ((count + 1) * 2 > mask + 1 || table.empty())
+	{
+		rebuild(table.empty() ? 1024 : (mask + 1) * 2);
+	}
+	if (contains(digest))
+	{
+		return;
+	}
+	count += 1;
+	bit32 bit = md5_bswap32(digest[0]) >> bitmap_shift;
+	bitmap[bit >> 5] |= 1u << (bit & 31);
+	if ((digest[0] | digest[1] | digest[2] | digest[3]) == 0)
+	{
+		has_zero = true;
+		return;
+	}
+	size_t slot = MD5TargetSlot(digest, mask);
+	while (table[slot * 4] | table[slot * 4 + 1] | table[slot * 4 + 2] | table[slot * 4 + 3])
+	{
+		slot = (slot + 1) & mask;
+	}
+	memcpy(&table[slot * 4], digest, 16);
+}
+
+bool MD5TargetSet::contains(const bit32 digest[4]) const
+{
+	if (count == 0)
+	{
+		return false;
+	}
+	if ((digest[0] | digest[1] | digest[2] | digest[3]) == 0)
+	{
+		return has_zero;
+	}
+	size_t slot = MD5TargetSlot(digest, mask);
+	while (true)
+	{
+		const bit32 *entry = &table[slot * 4];
+		if ((entry[0] | entry[1] | entry[2] | entry[3]) == 0)
+		{
+			return false;
+		}
+		if (memcmp(entry, digest, 16) == 0)
+		{
+			return true;
+		}
+		slot = (slot + 1) & mask;
+	}
+}
+
+vector<bit32> MD5TargetSet::list() const
+{
+	vector<bit32> digests;
+	for (size_t i = 0; i < table.size(); i += 4)
+	{
+		if (table[i] | table[i + 1] | table[i + 2] | table[i + 3])
+		{
+			digests.insert(digests.end(), &table[i], &table[i + 4]);
+		}
+	}
+	if (has_zero)
+	{
+		digests.insert(digests.end(), 4, 0);
+	}
+	return digests;
+}
+
+// 解析一个十六进制数字，不是十六进制数字时返回-1
+static inline int MD5HexDigit(char c)
+{
+	if (c >= '0' && c <= '9')
+	{
+		return c - '0';
+	}
+	if (c >= 'a' && c <= 'f')
+	{
+		return c - 'a' + 10;
+	}
+	if (c >= 'A' && c <= 'F')
+	{
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+size_t MD5TargetSet::load(string path)
+{
+	ifstream fin(path);
+	string line;
+	size_t loaded = 0;
+	size_t line_no = 0;
+	while (getline(fin, line))
+	{
+		line_no += 1;
+		// 去掉行尾的空白（包括Windows换行留下的\r），空行直接跳过
+		while (!line.empty() && isspace((unsigned char)line.back()))
+		{
+			line.pop_back();
+		}
+		if (line.empty())
+		{
+			continue;
+		}
+		// 每个字对应8个十六进制字符，和MD5Hash输出时setw(8)逐字打印的格式一致
+		// 必须恰好是32个十六进制数字，否则报告并跳过这一行
+		bit32 digest[4] = {0, 0, 0, 0};
+		bool valid = line.size() == 32;
+		for (size_t i = 0; valid && i < 32; i += 1)
+		{
+			int d = MD5HexDigit(line[i]);
+			valid = d >= 0;
+			digest[i / 8] = (digest[i / 8] << 4) | (bit32)d;
+		}
+		if (!valid)
+		{
+			cerr << path << ":" << line_no << ": not a 32-digit hex MD5, skipped" << endl;
+			continue;
+		}
+		insert(digest);
+		loaded += 1;
+	}
+	return loaded;
+}
@@ -1,8 +1,9 @@
+#pragma once
 
 #include <iostream>
 #include <string>
 #include <cstring>
-#include <arm_neon.h>
+#include <vector>
 
 using namespace std;
 
@@ -29,215 +30,88 @@ typedef unsigned int bit32;
 #define s43 15
 #define s44 21
 
+// 一次SIMD计算并行处理的消息数（通道数）的上限，对应AVX-512的16个32位通道
+// 实际使用的通道数取决于运行时选择的后端，见MD5Lanes()
+#define MD5_MAX_LANES 16
+
+// 下面的函数都不修改共享的状态，可以在多个线程中同时调用（MD5UseBackend除外）
+
 /**
- * @Basic MD5 functions.
- *
- * @param there bit32.
- *
- * @return one bit32.
- */
- // 定义了一系列MD5中的具体函数
- // 这四个计算函数是需要你进行SIMD并行化的
- // 可以看到，FGHI四个函数都涉及一系列位运算，在数据上是对齐的，非常容易实现SIMD的并行化
-
- /**
-  * @brief 使用 Neon intrinsics 实现 F(x, y, z) = ((x & y) | (~x & z))
-  * @param vx 包含 2 个 x 操作数的向量 (uint32x4_t)
-  * @param vy 包含 2 个 y 操作数的向量 (uint32x4_t)
-  * @param vz 包含 4 个 z 操作数的向量 (uint32x4_t)
-  * @return 包含 4 个 F(x, y, z) 结果的向量 (uint32x4_t)
-  */
-static inline uint32x2_t F(uint32x2_t vx, uint32x2_t vy, uint32x2_t vz)
-{
-	// 计算 (x & y)
-	uint32x2_t x_and_y = vand_u32(vx, vy);
-	// 计算 ~x
-	uint32x2_t not_x = vmvn_u32(vx);
-	// 计算 (~x & z)
-	uint32x2_t not_x_and_z = vand_u32(not_x, vz);
-	// 计算 (x & y) | (~x & z)
-	uint32x2_t result = vorr_u32(x_and_y, not_x_and_z);
-	return result;
-}
-/**
- * @brief 使用 Neon intrinsics 实现 G(x, y, z) = ((x & z) | (y & ~z))
- * @param vx 包含 4 个 x 操作数的向量 (uint32x4_t)
- * @param vy 包含 4 个 y 操作数的向量 (uint32x4_t)
- * @param vz 包含 4 个 z 操作数的向量 (uint32x4_t)
- * @return 包含 4 个 G(x, y, z) 结果的向量 (uint32x4_t)
- */
-static inline uint32x2_t G(uint32x2_t vx, uint32x2_t vy, uint32x2_t vz)
-{
-	uint32x2_t x_and_z = vand_u32(vx, vz);
-	uint32x2_t not_z = vmvn_u32(vz);
-	uint32x2_t y_and_not_z = vand_u32(vy, not_z);
-	uint32x2_t result = vorr_u32(x_and_z, y_and_not_z);
-	return result;
-}
-/**
- * @brief 使用 Neon intrinsics 实现 H(x, y, z) = (x ^ y ^ z)
- * @param vx 包含 4 个 x 操作数的向量 (uint32x4_t)
- * @param vy 包含 4 个 y 操作数的向量 (uint32x4_t)
- * @param vz 包含 4 个 z 操作数的向量 (uint32x4_t)
- * @return 包含 4 个 H(x, y, z) 结果的向量 (uint32x4_t)
+ * MD5Hash: 计算n个输入字符串的MD5
+ * @param input n个输入字符串
+ * @param[out] state n个MD5结果，state[i]对应input[i]
+ * @param n 输入的数目，可以是任意值
+ * 内部先按padding之后的block数对输入分组，block数相同的MD5Lanes()个消息一起进行SIMD计算，
+ * 因此长短不一的输入也不会让SIMD通道空转。一次传入的输入越多，分组的效果越好
  */
-static inline uint32x2_t H(uint32x2_t vx, uint32x2_t vy, uint32x2_t vz) {
-	// 计算 x ^ y
-	uint32x2_t x_xor_y = veor_u32(vx, vy);
-	// 计算 (x ^ y) ^ z
-	uint32x2_t result = veor_u32(x_xor_y, vz);
-	return result;
-}
+void MD5Hash(const string input[], bit32 state[][4], size_t n);
+
+// 同上，输入连续存放在一个缓冲区中：第i个输入是data中[offsets[i], offsets[i + 1])的部分，offsets共有n + 1项
+// 例如PriorityQueue::guesses，哈希时直接读取缓冲区，不需要先构造string
+void MD5Hash(const char *data, const size_t offsets[], bit32 state[][4], size_t n);
+
 /**
- * @brief 使用 Neon intrinsics 实现 I(x, y, z) = (y ^ (x | ~z))
- * @param vx 包含 4 个 x 操作数的向量 (uint32x4_t)
- * @param vy 包含 4 个 y 操作数的向量 (uint32x4_t)
- * @param vz 包含 4 个 z 操作数的向量 (uint32x4_t)
- * @return 包含 4 个 I(x, y, z) 结果的向量 (uint32x4_t)
+ * MD5HashSuffixes: 计算n个消息prefix + values[i]的MD5，所有values[i]的长度必须相同
+ * 这正是PCFG中一个PT生成的一组猜测：前缀固定，最后一个segment的value长度都相同，因此所有消息等长。
+ * 每个通道预先准备好padding之后的block，前缀、0x80和长度都已经写好，之后每个消息只需把value复制到
+ * 前缀后面，再直接交给SIMD压缩函数，不需要先把猜测拼成字符串或写入缓冲区
  */
-static inline uint32x2_t I(uint32x2_t vx, uint32x2_t vy, uint32x2_t vz) {
-	// 计算 ~z
-	uint32x2_t not_z = vmvn_u32(vz);
-	// 计算 (x | ~z)
-	uint32x2_t x_or_not_z = vorr_u32(vx, not_z);
-	// 计算 y ^ (x | ~z)
-	uint32x2_t result = veor_u32(vy, x_or_not_z);
-	return result;
-}
+void MD5HashSuffixes(const string &prefix, const string values[], bit32 state[][4], size_t n);
+
+// 当前使用的后端。程序启动后第一次用到时，根据cpuid选择CPU支持的最宽后端
+// 可能的名字：avx512、avx2、sse2、neon、scalar
+const char *MD5BackendName();
+int MD5Lanes();
+
+// 强制使用指定名字的后端（例如用于对比不同后端的性能），CPU不支持或名字不存在时返回false
+bool MD5UseBackend(const char *name);
 
 /**
- * @Rotate Left.
- *
- * @param {num} the raw number.
- *
- * @param {n} rotate left n.
- *
- * @return the number after rotated left.
+ * MD5TargetSet: 需要破解的目标MD5集合
+ * 目标放在开放寻址（线性探测）的哈希表中，每个表项就是16字节的MD5，一个cache line放4个
+ * 另外以MD5第一个字的高若干位为下标维护一个位图作为前置过滤：SIMD计算完一组通道后，
+ * 先用位图一次性检查所有通道，只有通过过滤的极少数通道才需要去哈希表中逐个查找
  */
- // 定义了一系列MD5中的具体函数
- // 这五个计算函数（ROTATELEFT/FF/GG/HH/II）和之前的FGHI一样，都是需要你进行SIMD并行化的
- // 但是你需要注意的是#define的功能及其效果，可以发现这里的FGHI是没有返回值的，为什么呢？你可以查询#define的含义和用法
-#include <arm_neon.h>
-static inline uint32x2_t ROTATELEFT(uint32x2_t vnum, const int n) {
-	// 原始(((num) << (n)) | ((num) >> (32-(n))))
-	if (n == 0) {
-		return vnum;
-	}
-	uint32x2_t left_shifted = vshl_n_u32(vnum, n); // Neon移位通常接受int
-	// 计算右移部分: vnum >> (32 - n)
-	uint32x2_t right_shifted = vshr_n_u32(vnum, 32 - n);
-	// 合并结果: (vnum << n) | (vnum >> (32 - n))
-	// 使用 vorrq_u32 将左移和右移的结果按位或
-	uint32x2_t result = vorr_u32(left_shifted, right_shifted);
-	return result;
-}
+class MD5TargetSet
+{
+public:
+	// 加入一个目标MD5
+	void insert(const bit32 digest[4]);
+
+	// 从文件中加载目标，每行恰好32个十六进制数字（即MD5Hash输出的格式），返回加载的数目
+	// 空行跳过；格式不对的行输出到cerr后跳过
+	size_t load(string path);
+
+	// 判断一个MD5是否是目标之一
+	bool contains(const bit32 digest[4]) const;
+
+	size_t size() const { return count; }
+
+	// 所有目标，每4个字是一个MD5
+	vector<bit32> list() const;
+
+	// 前置过滤的位图，共(1 << (32 - bitmap_shift))位。第一个字为w的MD5对应第(bswap(w) >> bitmap_shift)位
+	// 用bswap(w)而不是w，是因为它就是压缩函数算出的a，不需要先翻转字节序
+	vector<bit32> bitmap;
+	int bitmap_shift = 32;
+
+private:
+	void rebuild(size_t capacity);
+	// 哈希表，全0表示空位；全0的目标另外用has_zero记录
+	vector<bit32> table;
+	size_t mask = 0;
+	size_t count = 0;
+	bool has_zero = false;
+};
+
 /**
- * @brief 使用 Neon intrinsics 实现 FF 宏定义的操作，一次处理 4 组 32 位数据。
- *        对应宏: #define FF(a, b, c, d, x, s, ac) { \
- *                   (a) += F ((b), (c), (d)) + (x) + ac; \
- *                   (a) = ROTATELEFT ((a), (s)); \
- *                   (a) += (b); \
- *                 }
- * @param va 对应宏中的 'a' (输入向量，函数内部会对其进行计算并返回新值)
- * @param vb 对应宏中的 'b' (输入向量)
- * @param vc 对应宏中的 'c' (输入向量)
- * @param vd 对应宏中的 'd' (输入向量)
- * @param vx 对应宏中的 'x' (输入向量，通常是消息块)
- * @param s  对应宏中的 's' (循环左移的位数，标量)
- * @param ac 对应宏中的 'ac' (加法常量，32位标量)
- * @return 计算后的 'a' 向量 (uint32x4_t)
+ * MD5Crack: 计算n个输入的MD5，并找出其中MD5属于目标集合的输入
+ * @param input 输入
+ * @param n 输入数目
+ * @param targets 目标集合
+ * @param[out] hits 命中的输入在input中的下标，追加在后面
+ * @return 命中的数目
+ * 目标只有少数几个时，不超过55个字节的输入从目标MD5倒推压缩函数的最后若干步，只算到第45~61步就比较
  */
-static inline uint32x2_t FF(uint32x2_t va, uint32x2_t vb, uint32x2_t vc, uint32x2_t vd, uint32x2_t vx, const int s, uint32_t ac) {
-
-	// 1. 计算 F(b, c, d)
-	uint32x2_t f_result = F(vb, vc, vd);
-	// 2. 将加法常量 ac 复制到向量的所有通道
-	uint32x2_t vac = vdup_n_u32(ac);
-
-	// 3. 计算 a += F(b, c, d) + x + ac
-	// 分步进行加法：
-	// temp = F(b, c, d) + x
-	uint32x2_t temp_sum1 = vadd_u32(f_result, vx);
-	// temp = temp + ac
-	uint32x2_t temp_sum2 = vadd_u32(temp_sum1, vac);
-	// a = a + temp
-	va = vadd_u32(va, temp_sum2);
-
-	// 4. 计算 a = ROTATELEFT(a, s)
-
-	va = ROTATELEFT(va, s);
-
-	// 5. 计算 a += b
-	va = vadd_u32(va, vb);
-
-	// 6. 返回最终更新的 a 向量
-	return va;
-}
-static inline uint32x2_t GG(uint32x2_t va, uint32x2_t vb, uint32x2_t vc, uint32x2_t vd, uint32x2_t vx, const int s, uint32_t ac) {
-
-	// 1. 计算 G(b, c, d)
-	uint32x2_t g_result = G(vb, vc, vd);
-	// 2. 将加法常量 ac 复制到向量的所有通道
-	uint32x2_t vac = vdup_n_u32(ac);
-	// 3. 计算 a += G(b, c, d) + x + ac
-	// 分步进行加法：
-	// temp = G(b, c, d) + x
-	uint32x2_t temp_sum1 = vadd_u32(g_result, vx);
-	// temp = temp + ac
-	uint32x2_t temp_sum2 = vadd_u32(temp_sum1, vac);
-	// a = a + temp
-	va = vadd_u32(va, temp_sum2);
-
-	// 4. 计算 a = ROTATELEFT(a, s)
-	va = ROTATELEFT(va, s); // 调用你上面定义的ROTATELEFT函数
-
-	// 5. 计算 a += b
-	va = vadd_u32(va, vb);
-
-	// 6. 返回最终更新的 a 向量
-	return va;
-}
-static inline uint32x2_t HH(uint32x2_t va, uint32x2_t vb, uint32x2_t vc, uint32x2_t vd, uint32x2_t vx, const int s, uint32_t ac) {
-
-	// 1. 计算 H(b, c, d)
-	uint32x2_t h_result = H(vb, vc, vd);
-
-	// 2. 将加法常量 ac 复制到向量的所有通道
-	uint32x2_t vac = vdup_n_u32(ac);
-
-	// 3. 计算 a += H(b, c, d) + x + ac
-	uint32x2_t temp_sum1 = vadd_u32(h_result, vx);
-	uint32x2_t temp_sum2 = vadd_u32(temp_sum1, vac);
-	va = vadd_u32(va, temp_sum2);
-
-	// 4. 计算 a = ROTATELEFT(a, s)
-	va = ROTATELEFT(va, s);
-
-	// 5. 计算 a += b
-	va = vadd_u32(va, vb);
-
-	// 6. 返回最终更新的 a 向量
-	return va;
-}
-static inline uint32x2_t II(uint32x2_t va, uint32x2_t vb, uint32x2_t vc, uint32x2_t vd, uint32x2_t vx, int s, uint32_t ac) {
-
-	// 1. 计算 I(b, c, d)
-	uint32x2_t i_result = I(vb, vc, vd);
-
-	// 2. 将加法常量 ac 复制到向量的所有通道
-	uint32x2_t vac = vdup_n_u32(ac);
-
-	// 3. 计算 a += I(b, c, d) + x + ac
-	uint32x2_t temp_sum1 = vadd_u32(i_result, vx);
-	uint32x2_t temp_sum2 = vadd_u32(temp_sum1, vac);
-	va = vadd_u32(va, temp_sum2);
-
-	// 4. 计算 a = ROTATELEF
-	va = ROTATELEFT(va, s);
-	// 5. 计算 a += b
-	va = vadd_u32(va, vb);
-
-	// 6. 返回最终更新的 a 向量
-	return va;
-}
-void MD5Hash(const string input[2], bit32 state[2][4]);
+size_t MD5Crack(const string input[], size_t n, const MD5TargetSet &targets, vector<size_t> &hits);
+size_t MD5Crack(const char *data, const size_t offsets[], size_t n, const MD5TargetSet &targets, vector<size_t> &hits);
@@ -0,0 +1,130 @@
+#include "md5.h"
+
+// AVX2后端：256位寄存器（__m256i，8个通道）
+// 只有在运行时检测到CPU支持AVX2时，md5.cpp才会调用这里的函数
+#if defined(__x86_64__) || defined(__i386__)
+// GCC 12的avxintrin.h里，_mm*_undefined_*用"__Y = __Y"的自我赋值表示未定义的值，
+// 内联到本文件的函数之后会报出大量误报的-Wuninitialized，这里在本文件内关掉这两个警告
+// 告警的位置在头文件中，所以push必须放在#include之前，到文件末尾再pop
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+
+// 整个文件剩下的部分都按AVX2编译，这样不需要在编译指令里额外加-mavx2
+// 标准库的头文件必须在这一行之前包含，否则它们的内联函数也会被编译成AVX2指令，可能被链接到其他文件中
+#pragma GCC target("avx2")
+
+static inline __m256i md5_and(__m256i a, __m256i b) { return _mm256_and_si256(a, b); }
+static inline __m256i md5_or(__m256i a, __m256i b) { return _mm256_or_si256(a, b); }
+static inline __m256i md5_xor(__m256i a, __m256i b) { return _mm256_xor_si256(a, b); }
+static inline __m256i md5_not(__m256i a) { return _mm256_xor_si256(a, _mm256_set1_epi32(-1)); }
+static inline __m256i md5_add(__m256i a, __m256i b) { return _mm256_add_epi32(a, b); }
+static inline __m256i md5_addc(__m256i a, bit32 c) { return _mm256_add_epi32(a, _mm256_set1_epi32(c)); }
+template <int n>
+static inline __m256i md5_rotl(__m256i a) { return _mm256_or_si256(_mm256_slli_epi32(a, n), _mm256_srli_epi32(a, 32 - n)); }
+static inline void md5_load(__m256i &r, const bit32 *p) { r = _mm256_loadu_si256((const __m256i *)p); }
+static inline void md5_store(bit32 *p, __m256i a) { _mm256_storeu_si256((__m256i *)p, a); }
+static inline __m256i F(__m256i x, __m256i y, __m256i z) { return _mm256_or_si256(_mm256_and_si256(x, y), _mm256_andnot_si256(x, z)); }
+static inline __m256i G(__m256i x, __m256i y, __m256i z) { return _mm256_or_si256(_mm256_and_si256(x, z), _mm256_andnot_si256(z, y)); }
+
+// 8x8转置：每个128位半边内先unpack 32位、再unpack 64位元素，最后用permute2x128交换两个半边
+static inline void md5_transpose8(__m256i r[8])
+{
+	__m256i t[8];
+	for (int i = 0; i < 4; i++)
+	{
+		t[2 * i] = _mm256_unpacklo_epi32(r[2 * i], r[2 * i + 1]);
+		t[2 * i + 1] = _mm256_unpackhi_epi32(r[2 * i], r[2 * i + 1]);
+	}
+	__m256i u[8];
+	for (int i = 0; i < 2; i++)
+	{
+		u[4 * i] = _mm256_unpacklo_epi64(t[4 * i], t[4 * i + 2]);
+		u[4 * i + 1] = _mm256_unpackhi_epi64(t[4 * i], t[4 * i + 2]);
+		u[4 * i + 2] = _mm256_unpacklo_epi64(t[4 * i + 1], t[4 * i + 3]);
+		u[4 * i + 3] = _mm256_unpackhi_epi64(t[4 * i + 1], t[4 * i + 3]);
+	}
+	for (int j = 0; j < 4; j++)
+	{
+		r[j] = _mm256_permute2x128_si256(u[j], u[4 + j], 0x20);
+		r[4 + j] = _mm256_permute2x128_si256(u[j], u[4 + j], 0x31);
+	}
+}
+static inline void md5_load_blocks(__m256i x[16], const Byte *const block[])
+{
+	for (int h = 0; h < 2; h++)
+	{
+		__m256i r[8];
+		for (int l = 0; l < 8; l++)
+		{
+			r[l] = _mm256_loadu_si256((const __m256i *)(block[l] + 32 * h));
+		}
+		md5_transpose8(r);
+		for (int j = 0; j < 8; j++)
+		{
+			x[8 * h + j] = r[j];
+		}
+	}
+}
+static inline void md5_store_digests(bit32 *out, const __m256i s[4])
+{
+	// 每个128位半边内做4x4转置，o[j]的两个半边分别是第j个和第4 + j个通道的结果
+	__m256i t0 = _mm256_unpacklo_epi32(s[0], s[1]);
+	__m256i t1 = _mm256_unpackhi_epi32(s[0], s[1]);
+	__m256i t2 = _mm256_unpacklo_epi32(s[2], s[3]);
+	__m256i t3 = _mm256_unpackhi_epi32(s[2], s[3]);
+	__m256i o[4];
+	o[0] = _mm256_unpacklo_epi64(t0, t2);
+	o[1] = _mm256_unpackhi_epi64(t0, t2);
+	o[2] = _mm256_unpacklo_epi64(t1, t3);
+	o[3] = _mm256_unpackhi_epi64(t1, t3);
+	// 用pshufb按字节翻转每个32位字
+	const __m256i bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+										   3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	for (int j = 0; j < 4; j++)
+	{
+		o[j] = _mm256_shuffle_epi8(o[j], bswap);
+	}
+	_mm256_storeu_si256((__m256i *)out, _mm256_permute2x128_si256(o[0], o[1], 0x20));
+	_mm256_storeu_si256((__m256i *)(out + 8), _mm256_permute2x128_si256(o[2], o[3], 0x20));
+	_mm256_storeu_si256((__m256i *)(out + 16), _mm256_permute2x128_si256(o[0], o[1], 0x31));
+	_mm256_storeu_si256((__m256i *)(out + 24), _mm256_permute2x128_si256(o[2], o[3], 0x31));
+}
+// 用gather一次取出所有通道对应的位图中的字
+static inline unsigned md5_filter(__m256i a, const bit32 *bitmap, int shift)
+{
+	__m256i bit = _mm256_srlv_epi32(a, _mm256_set1_epi32(shift));
+	__m256i word = _mm256_i32gather_epi32((const int *)bitmap, _mm256_srli_epi32(bit, 5), 4);
+	__m256i hit = _mm256_and_si256(_mm256_srlv_epi32(word, _mm256_and_si256(bit, _mm256_set1_epi32(31))), _mm256_set1_epi32(1));
+	return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(hit, _mm256_set1_epi32(1))));
+}
+
+#include "md5_simd.h"
+
+void MD5Compress_avx2(bit32 *state, const Byte *const block[])
+{
+	MD5CompressBlocks<__m256i>(state, block);
+}
+
+void MD5CompressPrefix_avx2(bit32 *state, const bit32 mid[4], int start, const Byte *const block[])
+{
+	MD5CompressPrefix<__m256i>(state, mid, start, block);
+}
+
+void MD5Digest_avx2(const bit32 *state, bit32 *out)
+{
+	MD5DigestLanes<__m256i>(state, out);
+}
+
+unsigned MD5Filter_avx2(const bit32 *state, const bit32 *bitmap, int shift)
+{
+	return MD5FilterLanes<__m256i>(state, bitmap, shift);
+}
+
+unsigned MD5Reverse_avx2(const Byte *const block[], int stop, const bit32 *target, int n_targets)
+{
+	return MD5ReverseLanes<__m256i>(block, stop, target, n_targets);
+}
+#pragma GCC diagnostic pop
+#endif
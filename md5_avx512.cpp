@@ -0,0 +1,138 @@
+#include "md5.h"
+
+// AVX-512后端：512位寄存器（__m512i，16个通道）
+// 只有在运行时检测到CPU支持AVX-512F时，md5.cpp才会调用这里的函数
+#if defined(__x86_64__) || defined(__i386__)
+// GCC 12的avx512fintrin.h里，_mm*_undefined_*用"__Y = __Y"的自我赋值表示未定义的值，
+// 内联到本文件的函数之后会报出大量误报的-Wuninitialized，这里在本文件内关掉这两个警告
+// 告警的位置在头文件中，所以push必须放在#include之前，到文件末尾再pop
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+
+// 整个文件剩下的部分都按AVX-512F编译，原因同md5_avx2.cpp
+#pragma GCC target("avx512f")
+
+static inline __m512i md5_and(__m512i a, __m512i b) { return _mm512_and_si512(a, b); }
+static inline __m512i md5_or(__m512i a, __m512i b) { return _mm512_or_si512(a, b); }
+static inline __m512i md5_xor(__m512i a, __m512i b) { return _mm512_xor_si512(a, b); }
+static inline __m512i md5_not(__m512i a) { return _mm512_ternarylogic_epi32(a, a, a, 0x55); }
+static inline __m512i md5_add(__m512i a, __m512i b) { return _mm512_add_epi32(a, b); }
+static inline __m512i md5_addc(__m512i a, bit32 c) { return _mm512_add_epi32(a, _mm512_set1_epi32(c)); }
+// AVX-512自带循环左移指令
+template <int n>
+static inline __m512i md5_rotl(__m512i a) { return _mm512_rol_epi32(a, n); }
+static inline void md5_load(__m512i &r, const bit32 *p) { r = _mm512_loadu_si512(p); }
+static inline void md5_store(bit32 *p, __m512i a) { _mm512_storeu_si512(p, a); }
+
+// 四个基本函数都可以用一条vpternlogd完成，立即数就是函数的真值表
+// （x、y、z分别对应0xf0、0xcc、0xaa）
+static inline __m512i F(__m512i x, __m512i y, __m512i z) { return _mm512_ternarylogic_epi32(x, y, z, 0xca); }
+static inline __m512i G(__m512i x, __m512i y, __m512i z) { return _mm512_ternarylogic_epi32(x, y, z, 0xe4); }
+static inline __m512i H(__m512i x, __m512i y, __m512i z) { return _mm512_ternarylogic_epi32(x, y, z, 0x96); }
+static inline __m512i I(__m512i x, __m512i y, __m512i z) { return _mm512_ternarylogic_epi32(x, y, z, 0x39); }
+
+// 对四个向量做"128位块"层面的4x4转置：结果r[k]由a、b、c、d各自的第k个128位块依次组成
+static inline void md5_transpose_chunks(__m512i a, __m512i b, __m512i c, __m512i d, __m512i r[4])
+{
+	__m512i v0 = _mm512_shuffle_i32x4(a, b, 0x44);
+	__m512i v1 = _mm512_shuffle_i32x4(a, b, 0xee);
+	__m512i v2 = _mm512_shuffle_i32x4(c, d, 0x44);
+	__m512i v3 = _mm512_shuffle_i32x4(c, d, 0xee);
+	r[0] = _mm512_shuffle_i32x4(v0, v2, 0x88);
+	r[1] = _mm512_shuffle_i32x4(v0, v2, 0xdd);
+	r[2] = _mm512_shuffle_i32x4(v1, v3, 0x88);
+	r[3] = _mm512_shuffle_i32x4(v1, v3, 0xdd);
+}
+// 一个通道的整个block正好是一个__m512i，16个通道的block做16x16转置即得到16个消息字
+static inline void md5_load_blocks(__m512i x[16], const Byte *const block[])
+{
+	__m512i r[16];
+	for (int l = 0; l < 16; l++)
+	{
+		r[l] = _mm512_loadu_si512(block[l]);
+	}
+	// 每个128位块内先unpack 32位、再unpack 64位元素，完成4行一组的4x4转置
+	__m512i t[16];
+	for (int i = 0; i < 8; i++)
+	{
+		t[2 * i] = _mm512_unpacklo_epi32(r[2 * i], r[2 * i + 1]);
+		t[2 * i + 1] = _mm512_unpackhi_epi32(r[2 * i], r[2 * i + 1]);
+	}
+	__m512i u[16];
+	for (int i = 0; i < 4; i++)
+	{
+		u[4 * i] = _mm512_unpacklo_epi64(t[4 * i], t[4 * i + 2]);
+		u[4 * i + 1] = _mm512_unpackhi_epi64(t[4 * i], t[4 * i + 2]);
+		u[4 * i + 2] = _mm512_unpacklo_epi64(t[4 * i + 1], t[4 * i + 3]);
+		u[4 * i + 3] = _mm512_unpackhi_epi64(t[4 * i + 1], t[4 * i + 3]);
+	}
+	// 此时u[4q + j]的第c个128位块是第4c + j个消息字在第4q..4q+3个通道上的值，再转置128位块即可
+	for (int j = 0; j < 4; j++)
+	{
+		__m512i col[4];
+		md5_transpose_chunks(u[j], u[4 + j], u[8 + j], u[12 + j], col);
+		for (int c = 0; c < 4; c++)
+		{
+			x[4 * c + j] = col[c];
+		}
+	}
+}
+// AVX-512F没有按字节重排的指令，用两次循环移位加一次按位选择完成字节序翻转
+static inline __m512i md5_bswap(__m512i a)
+{
+	return _mm512_ternarylogic_epi32(_mm512_set1_epi32(0x00ff00ff), _mm512_rol_epi32(a, 8), _mm512_rol_epi32(a, 24), 0xca);
+}
+static inline void md5_store_digests(bit32 *out, const __m512i s[4])
+{
+	// 每个128位块内做4x4转置，o[j]的第c个128位块是第4c + j个通道的结果
+	__m512i t0 = _mm512_unpacklo_epi32(s[0], s[1]);
+	__m512i t1 = _mm512_unpackhi_epi32(s[0], s[1]);
+	__m512i t2 = _mm512_unpacklo_epi32(s[2], s[3]);
+	__m512i t3 = _mm512_unpackhi_epi32(s[2], s[3]);
+	__m512i o[4];
+	md5_transpose_chunks(_mm512_unpacklo_epi64(t0, t2), _mm512_unpackhi_epi64(t0, t2),
+						 _mm512_unpacklo_epi64(t1, t3), _mm512_unpackhi_epi64(t1, t3), o);
+	for (int c = 0; c < 4; c++)
+	{
+		_mm512_storeu_si512(out + 16 * c, md5_bswap(o[c]));
+	}
+}
+// 用gather一次取出所有通道对应的位图中的字，结果直接是掩码寄存器
+static inline unsigned md5_filter(__m512i a, const bit32 *bitmap, int shift)
+{
+	__m512i bit = _mm512_srlv_epi32(a, _mm512_set1_epi32(shift));
+	__m512i word = _mm512_i32gather_epi32(_mm512_srli_epi32(bit, 5), bitmap, 4);
+	__m512i hit = _mm512_srlv_epi32(word, _mm512_and_si512(bit, _mm512_set1_epi32(31)));
+	return _mm512_test_epi32_mask(hit, _mm512_set1_epi32(1));
+}
+
+#include "md5_simd.h"
+
+void MD5Compress_avx512(bit32 *state, const Byte *const block[])
+{
+	MD5CompressBlocks<__m512i>(state, block);
+}
+
+void MD5CompressPrefix_avx512(bit32 *state, const bit32 mid[4], int start, const Byte *const block[])
+{
+	MD5CompressPrefix<__m512i>(state, mid, start, block);
+}
+
+void MD5Digest_avx512(const bit32 *state, bit32 *out)
+{
+	MD5DigestLanes<__m512i>(state, out);
+}
+
+unsigned MD5Filter_avx512(const bit32 *state, const bit32 *bitmap, int shift)
+{
+	return MD5FilterLanes<__m512i>(state, bitmap, shift);
+}
+
+unsigned MD5Reverse_avx512(const Byte *const block[], int stop, const bit32 *target, int n_targets)
+{
+	return MD5ReverseLanes<__m512i>(block, stop, target, n_targets);
+}
+#pragma GCC diagnostic pop
+#endif
@@ -0,0 +1,677 @@
+#pragma once
+#include "md5.h"
+
+// 这个文件是MD5压缩函数的"通道数无关"实现
+// 所有函数都以模板形式编写，参数V表示一个装有若干个32位通道的向量类型
+// 只要为V提供下面这一组基本运算，就可以得到对应宽度的SIMD MD5：
+//   md5_and / md5_or / md5_xor / md5_not / md5_add / md5_addc / md5_rotl<n>
+//   md5_load / md5_store（按通道连续存放的bit32数组 <-> 向量）
+//   md5_load_blocks（从各通道的64字节block装入16个消息字，即转置）
+//   md5_store_digests（把a、b、c、d转置回每个通道4个字，并做字节序翻转，得到最终的MD5）
+// 另外，后端可以为md5_filter（用位图检查所有通道的a）提供带gather指令的重载
+// 通道数由sizeof(V) / sizeof(bit32)在编译期确定，例如uint32x4_t为4，__m256i为8，__m512i为16
+//
+// 注意：后端如果使用的是编译器内建的向量类型（例如uint32x4_t），它的运算必须在包含本文件之前声明，
+// 否则模板在定义处找不到对应的重载
+
+/**
+ * @brief 可移植的标量后端：N个bit32组成的"向量"
+ * 每个运算都是一个长度为N的简单循环，编译器通常可以把它自动向量化
+ */
+template <int N>
+struct md5_lanes
+{
+	bit32 v[N];
+};
+
+template <int N>
+static inline md5_lanes<N> md5_and(md5_lanes<N> a, md5_lanes<N> b)
+{
+	md5_lanes<N> r;
+	for (int i = 0; i < N; i++)
+		r.v[i] = a.v[i] & b.v[i];
+	return r;
+}
+template <int N>
+static inline md5_lanes<N> md5_or(md5_lanes<N> a, md5_lanes<N> b)
+{
+	md5_lanes<N> r;
+	for (int i = 0; i < N; i++)
+		r.v[i] = a.v[i] | b.v[i];
+	return r;
+}
+template <int N>
+static inline md5_lanes<N> md5_xor(md5_lanes<N> a, md5_lanes<N> b)
+{
+	md5_lanes<N> r;
+	for (int i = 0; i < N; i++)
+		r.v[i] = a.v[i] ^ b.v[i];
+	return r;
+}
+template <int N>
+static inline md5_lanes<N> md5_not(md5_lanes<N> a)
+{
+	md5_lanes<N> r;
+	for (int i = 0; i < N; i++)
+		r.v[i] = ~a.v[i];
+	return r;
+}
+template <int N>
+static inline md5_lanes<N> md5_add(md5_lanes<N> a, md5_lanes<N> b)
+{
+	md5_lanes<N> r;
+	for (int i = 0; i < N; i++)
+		r.v[i] = a.v[i] + b.v[i];
+	return r;
+}
+// 把同一个常量加到所有通道上（对应MD5中的ac）
+template <int N>
+static inline md5_lanes<N> md5_addc(md5_lanes<N> a, bit32 c)
+{
+	md5_lanes<N> r;
+	for (int i = 0; i < N; i++)
+		r.v[i] = a.v[i] + c;
+	return r;
+}
+template <int n, int N>
+static inline md5_lanes<N> md5_rotl(md5_lanes<N> a)
+{
+	md5_lanes<N> r;
+	for (int i = 0; i < N; i++)
+		r.v[i] = (a.v[i] << n) | (a.v[i] >> (32 - n));
+	return r;
+}
+template <int N>
+static inline void md5_load(md5_lanes<N> &r, const bit32 *p)
+{
+	memcpy(r.v, p, sizeof(r.v));
+}
+template <int N>
+static inline void md5_store(bit32 *p, md5_lanes<N> a)
+{
+	memcpy(p, a.v, sizeof(a.v));
+}
+template <int N>
+static inline void md5_load_blocks(md5_lanes<N> x[16], const Byte *const block[])
+{
+	for (int i1 = 0; i1 < 16; ++i1)
+	{
+		for (int l = 0; l < N; l++)
+		{
+			const Byte *p = block[l] + 4 * i1;
+			x[i1].v[l] = (p[0]) | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+		}
+	}
+}
+template <int N>
+static inline void md5_store_digests(bit32 *out, const md5_lanes<N> s[4])
+{
+	for (int l = 0; l < N; l++)
+	{
+		for (int k = 0; k < 4; k++)
+		{
+			bit32 value = s[k].v[l];
+			out[l * 4 + k] = ((value & 0xff) << 24) |		 // 将最低字节移到最高位
+				((value & 0xff00) << 8) |	 // 将次低字节左移
+				((value & 0xff0000) >> 8) |	 // 将次高字节右移
+				((value & 0xff000000) >> 24); // 将最高字节移到最低位
+		}
+	}
+}
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+// Neon后端：使用完整的128位寄存器（uint32x4_t，4个通道）
+static inline uint32x4_t md5_and(uint32x4_t a, uint32x4_t b) { return vandq_u32(a, b); }
+static inline uint32x4_t md5_or(uint32x4_t a, uint32x4_t b) { return vorrq_u32(a, b); }
+static inline uint32x4_t md5_xor(uint32x4_t a, uint32x4_t b) { return veorq_u32(a, b); }
+static inline uint32x4_t md5_not(uint32x4_t a) { return vmvnq_u32(a); }
+static inline uint32x4_t md5_add(uint32x4_t a, uint32x4_t b) { return vaddq_u32(a, b); }
+static inline uint32x4_t md5_addc(uint32x4_t a, bit32 c) { return vaddq_u32(a, vdupq_n_u32(c)); }
+// 左移之后用vsri（右移并插入）补上高位移出的部分，比"左移|右移"少一条指令
+template <int n>
+static inline uint32x4_t md5_rotl(uint32x4_t a) { return vsriq_n_u32(vshlq_n_u32(a, n), a, 32 - n); }
+static inline void md5_load(uint32x4_t &r, const bit32 *p) { r = vld1q_u32(p); }
+static inline void md5_store(bit32 *p, uint32x4_t a) { vst1q_u32(p, a); }
+// 4x4转置：先用vtrn交换相邻两行的奇偶元素，再拼接高低两半
+static inline void md5_transpose4(uint32x4_t &r0, uint32x4_t &r1, uint32x4_t &r2, uint32x4_t &r3)
+{
+	uint32x4x2_t t01 = vtrnq_u32(r0, r1);
+	uint32x4x2_t t23 = vtrnq_u32(r2, r3);
+	r0 = vcombine_u32(vget_low_u32(t01.val[0]), vget_low_u32(t23.val[0]));
+	r1 = vcombine_u32(vget_low_u32(t01.val[1]), vget_low_u32(t23.val[1]));
+	r2 = vcombine_u32(vget_high_u32(t01.val[0]), vget_high_u32(t23.val[0]));
+	r3 = vcombine_u32(vget_high_u32(t01.val[1]), vget_high_u32(t23.val[1]));
+}
+static inline void md5_load_blocks(uint32x4_t x[16], const Byte *const block[])
+{
+	for (int g = 0; g < 4; g++)
+	{
+		uint32x4_t r0 = vld1q_u32((const bit32 *)(block[0] + 16 * g));
+		uint32x4_t r1 = vld1q_u32((const bit32 *)(block[1] + 16 * g));
+		uint32x4_t r2 = vld1q_u32((const bit32 *)(block[2] + 16 * g));
+		uint32x4_t r3 = vld1q_u32((const bit32 *)(block[3] + 16 * g));
+		md5_transpose4(r0, r1, r2, r3);
+		x[4 * g] = r0;
+		x[4 * g + 1] = r1;
+		x[4 * g + 2] = r2;
+		x[4 * g + 3] = r3;
+	}
+}
+static inline void md5_store_digests(bit32 *out, const uint32x4_t s[4])
+{
+	uint32x4_t r0 = s[0], r1 = s[1], r2 = s[2], r3 = s[3];
+	md5_transpose4(r0, r1, r2, r3);
+	// vrev32按字节翻转每个32位字
+	vst1q_u32(out, vreinterpretq_u32_u8(vrev32q_u8(vreinterpretq_u8_u32(r0))));
+	vst1q_u32(out + 4, vreinterpretq_u32_u8(vrev32q_u8(vreinterpretq_u8_u32(r1))));
+	vst1q_u32(out + 8, vreinterpretq_u32_u8(vrev32q_u8(vreinterpretq_u8_u32(r2))));
+	vst1q_u32(out + 12, vreinterpretq_u32_u8(vrev32q_u8(vreinterpretq_u8_u32(r3))));
+}
+// Neon的vbsl（按位选择）正好就是F和G的形式
+static inline uint32x4_t F(uint32x4_t x, uint32x4_t y, uint32x4_t z) { return vbslq_u32(x, y, z); }
+static inline uint32x4_t G(uint32x4_t x, uint32x4_t y, uint32x4_t z) { return vbslq_u32(z, x, y); }
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+// SSE2后端：x86-64上一定可用，128位寄存器（__m128i，4个通道）
+// 更宽的AVX2/AVX-512后端在md5_avx2.cpp/md5_avx512.cpp中，运行时再决定是否使用
+static inline __m128i md5_and(__m128i a, __m128i b) { return _mm_and_si128(a, b); }
+static inline __m128i md5_or(__m128i a, __m128i b) { return _mm_or_si128(a, b); }
+static inline __m128i md5_xor(__m128i a, __m128i b) { return _mm_xor_si128(a, b); }
+static inline __m128i md5_not(__m128i a) { return _mm_xor_si128(a, _mm_set1_epi32(-1)); }
+static inline __m128i md5_add(__m128i a, __m128i b) { return _mm_add_epi32(a, b); }
+static inline __m128i md5_addc(__m128i a, bit32 c) { return _mm_add_epi32(a, _mm_set1_epi32(c)); }
+template <int n>
+static inline __m128i md5_rotl(__m128i a) { return _mm_or_si128(_mm_slli_epi32(a, n), _mm_srli_epi32(a, 32 - n)); }
+static inline void md5_load(__m128i &r, const bit32 *p) { r = _mm_loadu_si128((const __m128i *)p); }
+static inline void md5_store(bit32 *p, __m128i a) { _mm_storeu_si128((__m128i *)p, a); }
+// 4x4转置：unpack 32位元素得到两行交错的结果，再unpack 64位元素
+static inline void md5_transpose4(__m128i &r0, __m128i &r1, __m128i &r2, __m128i &r3)
+{
+	__m128i t0 = _mm_unpacklo_epi32(r0, r1);
+	__m128i t1 = _mm_unpacklo_epi32(r2, r3);
+	__m128i t2 = _mm_unpackhi_epi32(r0, r1);
+	__m128i t3 = _mm_unpackhi_epi32(r2, r3);
+	r0 = _mm_unpacklo_epi64(t0, t1);
+	r1 = _mm_unpackhi_epi64(t0, t1);
+	r2 = _mm_unpacklo_epi64(t2, t3);
+	r3 = _mm_unpackhi_epi64(t2, t3);
+}
+static inline void md5_load_blocks(__m128i x[16], const Byte *const block[])
+{
+	for (int g = 0; g < 4; g++)
+	{
+		__m128i r0 = _mm_loadu_si128((const __m128i *)(block[0] + 16 * g));
+		__m128i r1 = _mm_loadu_si128((const __m128i *)(block[1] + 16 * g));
+		__m128i r2 = _mm_loadu_si128((const __m128i *)(block[2] + 16 * g));
+		__m128i r3 = _mm_loadu_si128((const __m128i *)(block[3] + 16 * g));
+		md5_transpose4(r0, r1, r2, r3);
+		x[4 * g] = r0;
+		x[4 * g + 1] = r1;
+		x[4 * g + 2] = r2;
+		x[4 * g + 3] = r3;
+	}
+}
+// SSE2没有按字节重排的指令：先交换每个16位中的两个字节，再交换每个32位中的两个16位
+static inline __m128i md5_bswap(__m128i a)
+{
+	a = _mm_or_si128(_mm_slli_epi16(a, 8), _mm_srli_epi16(a, 8));
+	return _mm_shufflehi_epi16(_mm_shufflelo_epi16(a, 0xb1), 0xb1);
+}
+static inline void md5_store_digests(bit32 *out, const __m128i s[4])
+{
+	__m128i r0 = s[0], r1 = s[1], r2 = s[2], r3 = s[3];
+	md5_transpose4(r0, r1, r2, r3);
+	_mm_storeu_si128((__m128i *)out, md5_bswap(r0));
+	_mm_storeu_si128((__m128i *)(out + 4), md5_bswap(r1));
+	_mm_storeu_si128((__m128i *)(out + 8), md5_bswap(r2));
+	_mm_storeu_si128((__m128i *)(out + 12), md5_bswap(r3));
+}
+// andnot一条指令就能算出(~x & z)
+static inline __m128i F(__m128i x, __m128i y, __m128i z) { return _mm_or_si128(_mm_and_si128(x, y), _mm_andnot_si128(x, z)); }
+static inline __m128i G(__m128i x, __m128i y, __m128i z) { return _mm_or_si128(_mm_and_si128(x, z), _mm_andnot_si128(z, y)); }
+#endif
+
+/**
+ * @Basic MD5 functions.
+ *
+ * @param there vectors of bit32.
+ *
+ * @return one vector of bit32.
+ */
+// 定义了一系列MD5中的具体函数，每个通道独立计算，互不干扰
+// 后端可以提供同名的非模板重载（例如Neon的vbsl），重载决议会优先选择它们
+
+// F(x, y, z) = ((x & y) | (~x & z))
+template <class V>
+static inline V F(V x, V y, V z)
+{
+	return md5_or(md5_and(x, y), md5_and(md5_not(x), z));
+}
+// G(x, y, z) = ((x & z) | (y & ~z))
+template <class V>
+static inline V G(V x, V y, V z)
+{
+	return md5_or(md5_and(x, z), md5_and(y, md5_not(z)));
+}
+// H(x, y, z) = (x ^ y ^ z)
+template <class V>
+static inline V H(V x, V y, V z)
+{
+	return md5_xor(md5_xor(x, y), z);
+}
+// I(x, y, z) = (y ^ (x | ~z))
+template <class V>
+static inline V I(V x, V y, V z)
+{
+	return md5_xor(y, md5_or(x, md5_not(z)));
+}
+
+/**
+ * @brief FF/GG/HH/II：MD5的单步操作
+ *        对应宏: #define FF(a, b, c, d, x, s, ac) { \
+ *                   (a) += F ((b), (c), (d)) + (x) + ac; \
+ *                   (a) = ROTATELEFT ((a), (s)); \
+ *                   (a) += (b); \
+ *                 }
+ * 循环左移的位数s作为模板参数传入，保证所有后端都能使用立即数形式的移位指令
+ * @return 计算后的 'a' 向量
+ */
+template <int s, class V>
+static inline V FF(V a, V b, V c, V d, V x, bit32 ac)
+{
+	a = md5_add(a, md5_addc(md5_add(F(b, c, d), x), ac));
+	a = md5_rotl<s>(a);
+	return md5_add(a, b);
+}
+template <int s, class V>
+static inline V GG(V a, V b, V c, V d, V x, bit32 ac)
+{
+	a = md5_add(a, md5_addc(md5_add(G(b, c, d), x), ac));
+	a = md5_rotl<s>(a);
+	return md5_add(a, b);
+}
+template <int s, class V>
+static inline V HH(V a, V b, V c, V d, V x, bit32 ac)
+{
+	a = md5_add(a, md5_addc(md5_add(H(b, c, d), x), ac));
+	a = md5_rotl<s>(a);
+	return md5_add(a, b);
+}
+template <int s, class V>
+static inline V II(V a, V b, V c, V d, V x, bit32 ac)
+{
+	a = md5_add(a, md5_addc(md5_add(I(b, c, d), x), ac));
+	a = md5_rotl<s>(a);
+	return md5_add(a, b);
+}
+
+/**
+ * MD5Steps: 执行压缩函数的第start+1步到第stop步（完整的压缩是第1步到第64步），直接更新va、vb、vc、vd
+ * 第1、2、3、4步分别写入a、d、c、b，之后依次循环
+ * 共享前缀的消息可以跳过只用到前缀的第一轮的前若干步（见md5.cpp中的MD5HashPrefix），
+ * 单目标破解会在第45步之后提前停下（见md5.cpp中的MD5Reverser）。
+ * start为常量0、stop为常量64时，下面的跳转和判断都会被编译器消除
+ */
+template <class V>
+static inline void MD5Steps(V &va, V &vb, V &vc, V &vd, const V x[16], int start, int stop)
+{
+	/* Round 1 */
+	// 从第start+1步开始，之后的case依次往下执行
+	switch (start)
+	{
+	case 0:
+		va = FF<s11>(va, vb, vc, vd, x[0], 0xd76aa478);
+	case 1:
+		vd = FF<s12>(vd, va, vb, vc, x[1], 0xe8c7b756);
+	case 2:
+		vc = FF<s13>(vc, vd, va, vb, x[2], 0x242070db);
+	case 3:
+		vb = FF<s14>(vb, vc, vd, va, x[3], 0xc1bdceee);
+	case 4:
+		va = FF<s11>(va, vb, vc, vd, x[4], 0xf57c0faf);
+	case 5:
+		vd = FF<s12>(vd, va, vb, vc, x[5], 0x4787c62a);
+	case 6:
+		vc = FF<s13>(vc, vd, va, vb, x[6], 0xa8304613);
+	case 7:
+		vb = FF<s14>(vb, vc, vd, va, x[7], 0xfd469501);
+	case 8:
+		va = FF<s11>(va, vb, vc, vd, x[8], 0x698098d8);
+	case 9:
+		vd = FF<s12>(vd, va, vb, vc, x[9], 0x8b44f7af);
+	case 10:
+		vc = FF<s13>(vc, vd, va, vb, x[10], 0xffff5bb1);
+	case 11:
+		vb = FF<s14>(vb, vc, vd, va, x[11], 0x895cd7be);
+	case 12:
+		va = FF<s11>(va, vb, vc, vd, x[12], 0x6b901122);
+	case 13:
+		vd = FF<s12>(vd, va, vb, vc, x[13], 0xfd987193);
+	case 14:
+		vc = FF<s13>(vc, vd, va, vb, x[14], 0xa679438e);
+	case 15:
+		vb = FF<s14>(vb, vc, vd, va, x[15], 0x49b40821);
+	}
+
+	/* Round 2 */
+	va = GG<s21>(va, vb, vc, vd, x[1], 0xf61e2562);
+	vd = GG<s22>(vd, va, vb, vc, x[6], 0xc040b340);
+	vc = GG<s23>(vc, vd, va, vb, x[11], 0x265e5a51);
+	vb = GG<s24>(vb, vc, vd, va, x[0], 0xe9b6c7aa);
+	va = GG<s21>(va, vb, vc, vd, x[5], 0xd62f105d);
+	vd = GG<s22>(vd, va, vb, vc, x[10], 0x2441453);
+	vc = GG<s23>(vc, vd, va, vb, x[15], 0xd8a1e681);
+	vb = GG<s24>(vb, vc, vd, va, x[4], 0xe7d3fbc8);
+	va = GG<s21>(va, vb, vc, vd, x[9], 0x21e1cde6);
+	vd = GG<s22>(vd, va, vb, vc, x[14], 0xc33707d6);
+	vc = GG<s23>(vc, vd, va, vb, x[3], 0xf4d50d87);
+	vb = GG<s24>(vb, vc, vd, va, x[8], 0x455a14ed);
+	va = GG<s21>(va, vb, vc, vd, x[13], 0xa9e3e905);
+	vd = GG<s22>(vd, va, vb, vc, x[2], 0xfcefa3f8);
+	vc = GG<s23>(vc, vd, va, vb, x[7], 0x676f02d9);
+	vb = GG<s24>(vb, vc, vd, va, x[12], 0x8d2a4c8a);
+
+	/* Round 3 */
+	va = HH<s31>(va, vb, vc, vd, x[5], 0xfffa3942);
+	vd = HH<s32>(vd, va, vb, vc, x[8], 0x8771f681);
+	vc = HH<s33>(vc, vd, va, vb, x[11], 0x6d9d6122);
+	vb = HH<s34>(vb, vc, vd, va, x[14], 0xfde5380c);
+	va = HH<s31>(va, vb, vc, vd, x[1], 0xa4beea44);
+	vd = HH<s32>(vd, va, vb, vc, x[4], 0x4bdecfa9);
+	vc = HH<s33>(vc, vd, va, vb, x[7], 0xf6bb4b60);
+	vb = HH<s34>(vb, vc, vd, va, x[10], 0xbebfbc70);
+	va = HH<s31>(va, vb, vc, vd, x[13], 0x289b7ec6);
+	vd = HH<s32>(vd, va, vb, vc, x[0], 0xeaa127fa);
+	vc = HH<s33>(vc, vd, va, vb, x[3], 0xd4ef3085);
+	vb = HH<s34>(vb, vc, vd, va, x[6], 0x4881d05);
+	va = HH<s31>(va, vb, vc, vd, x[9], 0xd9d4d039);
+	if (stop == 45)
+	{
+		return;
+	}
+	vd = HH<s32>(vd, va, vb, vc, x[12], 0xe6db99e5);
+	if (stop == 46)
+	{
+		return;
+	}
+	vc = HH<s33>(vc, vd, va, vb, x[15], 0x1fa27cf8);
+	if (stop == 47)
+	{
+		return;
+	}
+	vb = HH<s34>(vb, vc, vd, va, x[2], 0xc4ac5665);
+	if (stop == 48)
+	{
+		return;
+	}
+
+	/* Round 4 */
+	va = II<s41>(va, vb, vc, vd, x[0], 0xf4292244);
+	if (stop == 49)
+	{
+		return;
+	}
+	vd = II<s42>(vd, va, vb, vc, x[7], 0x432aff97);
+	if (stop == 50)
+	{
+		return;
+	}
+	vc = II<s43>(vc, vd, va, vb, x[14], 0xab9423a7);
+	if (stop == 51)
+	{
+		return;
+	}
+	vb = II<s44>(vb, vc, vd, va, x[5], 0xfc93a039);
+	if (stop == 52)
+	{
+		return;
+	}
+	va = II<s41>(va, vb, vc, vd, x[12], 0x655b59c3);
+	if (stop == 53)
+	{
+		return;
+	}
+	vd = II<s42>(vd, va, vb, vc, x[3], 0x8f0ccc92);
+	if (stop == 54)
+	{
+		return;
+	}
+	vc = II<s43>(vc, vd, va, vb, x[10], 0xffeff47d);
+	if (stop == 55)
+	{
+		return;
+	}
+	vb = II<s44>(vb, vc, vd, va, x[1], 0x85845dd1);
+	if (stop == 56)
+	{
+		return;
+	}
+	va = II<s41>(va, vb, vc, vd, x[8], 0x6fa87e4f);
+	if (stop == 57)
+	{
+		return;
+	}
+	vd = II<s42>(vd, va, vb, vc, x[15], 0xfe2ce6e0);
+	if (stop == 58)
+	{
+		return;
+	}
+	vc = II<s43>(vc, vd, va, vb, x[6], 0xa3014314);
+	if (stop == 59)
+	{
+		return;
+	}
+	vb = II<s44>(vb, vc, vd, va, x[13], 0x4e0811a1);
+	if (stop == 60)
+	{
+		return;
+	}
+	va = II<s41>(va, vb, vc, vd, x[4], 0xf7537e82);
+	if (stop == 61)
+	{
+		return;
+	}
+	vd = II<s42>(vd, va, vb, vc, x[11], 0xbd3af235);
+	if (stop == 62)
+	{
+		return;
+	}
+	vc = II<s43>(vc, vd, va, vb, x[2], 0x2ad7d2bb);
+	if (stop == 63)
+	{
+		return;
+	}
+	vb = II<s44>(vb, vc, vd, va, x[9], 0xeb86d391);
+}
+
+/**
+ * MD5Compress: 对V中的每个通道，各自用一个512bit的block更新state
+ * @param[in,out] state state[0..3]分别是所有通道的a、b、c、d
+ * @param x x[k]是所有通道消息块中的第k个32位字
+ */
+template <class V>
+static inline void MD5Compress(V state[4], const V x[16])
+{
+	V va = state[0];
+	V vb = state[1];
+	V vc = state[2];
+	V vd = state[3];
+	MD5Steps(va, vb, vc, vd, x, 0, 64);
+
+	state[0] = md5_add(state[0], va);
+	state[1] = md5_add(state[1], vb);
+	state[2] = md5_add(state[2], vc);
+	state[3] = md5_add(state[3], vd);
+}
+
+/**
+ * md5_filter: 用位图对所有通道的a做前置过滤，见md5.h中的MD5TargetSet
+ * 这是没有gather指令时的通用实现：存回内存后逐个通道查位图
+ * @return 第l位为1表示第l个通道通过了过滤
+ */
+template <class V>
+static inline unsigned md5_filter(V a, const bit32 *bitmap, int shift)
+{
+	const int lanes = sizeof(V) / sizeof(bit32);
+	bit32 v[lanes];
+	md5_store(v, a);
+	unsigned mask = 0;
+	for (int l = 0; l < lanes; l++)
+	{
+		bit32 bit = v[l] >> shift;
+		mask |= ((bitmap[bit >> 5] >> (bit & 31)) & 1) << l;
+	}
+	return mask;
+}
+
+/**
+ * MD5CompressBlocks: 后端的统一入口，对lanes个通道各压缩一个block，lanes = sizeof(V) / sizeof(bit32)
+ * state在内存中按通道存放，这样在两次调用之间可以单独替换某个通道的state
+ * @param[in,out] state state[k * lanes + l]是第l个通道的第k个状态字
+ * @param block block[l]指向第l个通道当前的64字节block，由后端用宽的load和shuffle直接转置成16个消息字
+ */
+template <class V>
+static inline void MD5CompressBlocks(bit32 *state, const Byte *const block[])
+{
+	const int lanes = sizeof(V) / sizeof(bit32);
+	V vstate[4];
+	V vx[16];
+	for (int k = 0; k < 4; k += 1)
+	{
+		md5_load(vstate[k], state + k * lanes);
+	}
+	md5_load_blocks(vx, block);
+	MD5Compress(vstate, vx);
+	for (int k = 0; k < 4; k += 1)
+	{
+		md5_store(state + k * lanes, vstate[k]);
+	}
+}
+
+/**
+ * MD5CompressPrefix: 所有通道的消息共享同一个前缀时的MD5CompressBlocks
+ * 第一轮的前start步只用到前缀中的消息字，调用者已经算好，这里广播到所有通道之后从第start+1步继续
+ * @param[in,out] state 同MD5CompressBlocks
+ * @param mid 前start步之后的a、b、c、d
+ * @param block 同MD5CompressBlocks
+ */
+template <class V>
+static inline void MD5CompressPrefix(bit32 *state, const bit32 mid[4], int start, const Byte *const block[])
+{
+	const int lanes = sizeof(V) / sizeof(bit32);
+	V vstate[4];
+	V v[4];
+	V vx[16];
+	bit32 r[lanes];
+	for (int k = 0; k < 4; k += 1)
+	{
+		md5_load(vstate[k], state + k * lanes);
+		for (int l = 0; l < lanes; l += 1)
+		{
+			r[l] = mid[k];
+		}
+		md5_load(v[k], r);
+	}
+	md5_load_blocks(vx, block);
+	MD5Steps(v[0], v[1], v[2], v[3], vx, start, 64);
+	for (int k = 0; k < 4; k += 1)
+	{
+		md5_store(state + k * lanes, md5_add(vstate[k], v[k]));
+	}
+}
+
+/**
+ * MD5DigestLanes: 把按通道存放的state转换成每个通道最终的MD5
+ * @param state 同MD5CompressBlocks
+ * @param[out] out out[l * 4 + k]是第l个通道的MD5的第k个字
+ */
+template <class V>
+static inline void MD5DigestLanes(const bit32 *state, bit32 *out)
+{
+	const int lanes = sizeof(V) / sizeof(bit32);
+	V vstate[4];
+	for (int k = 0; k < 4; k += 1)
+	{
+		md5_load(vstate[k], state + k * lanes);
+	}
+	md5_store_digests(out, vstate);
+}
+
+/**
+ * MD5FilterLanes: 用位图检查所有通道的a，即最终MD5第一个字翻转字节序之后的值
+ * @param state 同MD5CompressBlocks，state的前lanes个字就是所有通道的a
+ * @return 通过过滤的通道
+ */
+template <class V>
+static inline unsigned MD5FilterLanes(const bit32 *state, const bit32 *bitmap, int shift)
+{
+	V a;
+	md5_load(a, state);
+	return md5_filter(a, bitmap, shift);
+}
+
+static const bit32 md5_init_state[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+
+/**
+ * MD5ReverseLanes: 单block消息的提前比对。从初始state开始只算前stop步，
+ * 再把第stop步写入的寄存器和从目标MD5倒推出来的值比较
+ * @param block 同MD5CompressBlocks，每个通道都是一个完整的单block消息
+ * @param target n_targets个目标在第stop步写入的寄存器的值
+ * @return 第l位为1表示第l个通道和某个目标相符，需要再计算完整的MD5确认
+ */
+template <class V>
+static inline unsigned MD5ReverseLanes(const Byte *const block[], int stop, const bit32 *target, int n_targets)
+{
+	const int lanes = sizeof(V) / sizeof(bit32);
+	V vx[16];
+	V v[4];
+	bit32 r[lanes];
+	for (int k = 0; k < 4; k += 1)
+	{
+		for (int l = 0; l < lanes; l += 1)
+		{
+			r[l] = md5_init_state[k];
+		}
+		md5_load(v[k], r);
+	}
+	md5_load_blocks(vx, block);
+	MD5Steps(v[0], v[1], v[2], v[3], vx, 0, stop);
+
+	md5_store(r, v[(4 - (stop - 1) % 4) % 4]);
+	unsigned mask = 0;
+	for (int l = 0; l < lanes; l += 1)
+	{
+		for (int t = 0; t < n_targets; t += 1)
+		{
+			if (r[l] == target[t])
+			{
+				mask |= 1u << l;
+			}
+		}
+	}
+	return mask;
+}
+
+// 编译期就能确定可用的后端：Neon、SSE2，或者可移植实现
+#if defined(__ARM_NEON)
+typedef uint32x4_t md5_vec;
+#elif defined(__SSE2__)
+typedef __m128i md5_vec;
+#else
+typedef md5_lanes<4> md5_vec;
+#endif
+
+// 需要运行时检测CPU的x86后端，各自位于单独的源文件中
+#if defined(__x86_64__) || defined(__i386__)
+void MD5Compress_avx2(bit32 *state, const Byte *const block[]);
+void MD5Digest_avx2(const bit32 *state, bit32 *out);
+unsigned MD5Filter_avx2(const bit32 *state, const bit32 *bitmap, int shift);
+unsigned MD5Reverse_avx2(const Byte *const block[], int stop, const bit32 *target, int n_targets);
+void MD5CompressPrefix_avx2(bit32 *state, const bit32 mid[4], int start, const Byte *const block[]);
+void MD5Compress_avx512(bit32 *state, const Byte *const block[]);
+void MD5Digest_avx512(const bit32 *state, bit32 *out);
+unsigned MD5Filter_avx512(const bit32 *state, const bit32 *bitmap, int shift);
+unsigned MD5Reverse_avx512(const Byte *const block[], int stop, const bit32 *target, int n_targets);
+void MD5CompressPrefix_avx512(bit32 *state, const bit32 mid[4], int start, const Byte *const block[]);
+#endif
@@ -7,8 +7,15 @@
 scp master_ubss1:/home/${USER}/guess/main /home/${USER} 1>&2
 scp -r master_ubss1:/home/${USER}/guess/files/ /home/${USER}/ 1>&2
 /usr/local/bin/pscp -h $PBS_NODEFILE /home/${USER}/main /home/${USER} 1>&2
+# 检查点及其run文件保存在master_ubss1:/home/${USER}/guess/checkpoint/，作业被中断后重新提交即从检查点继续
+rm -rf /home/${USER}/checkpoint
+scp -r master_ubss1:/home/${USER}/guess/checkpoint /home/${USER}/ 1>&2 || mkdir -p /home/${USER}/checkpoint
 
-/home/${USER}/main
+/home/${USER}/main -c /home/${USER}/checkpoint/ckpt
 rm /home/${USER}/main
 scp -r /home/${USER}/files/ master_ubss1:/home/${USER}/guess/ 2>&1
 rm -r /home/${USER}/files/
+# 整个目录替换，已经不再引用的run文件不会留在master_ubss1上
+scp -r /home/${USER}/checkpoint master_ubss1:/home/${USER}/guess/checkpoint.new 2>&1 &&
+    ssh master_ubss1 "rm -rf /home/${USER}/guess/checkpoint && mv /home/${USER}/guess/checkpoint.new /home/${USER}/guess/checkpoint" 2>&1
+rm -r /home/${USER}/checkpoint
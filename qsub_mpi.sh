@@ -7,11 +7,19 @@
 NODES=$(cat $PBS_NODEFILE | sort | uniq)
 # 注意把所有的ntt换成你的选题
 
+# 检查点及其run文件保存在master_ubss1:/home/${USER}/guess/checkpoint/，作业被中断后重新提交即从检查点继续
 for node in $NODES; do
     scp master_ubss1:/home/${USER}/guess/main ${node}:/home/${USER} 1>&2
     scp -r master_ubss1:/home/${USER}/guess/files ${node}:/home/${USER}/ 1>&2
+    ssh ${node} "rm -rf /home/${USER}/checkpoint" 1>&2
+    scp -r master_ubss1:/home/${USER}/guess/checkpoint ${node}:/home/${USER}/ 1>&2 || ssh ${node} "mkdir -p /home/${USER}/checkpoint" 1>&2
 done
 
-/usr/local/bin/mpiexec -np 4 -machinefile $PBS_NODEFILE /home/${USER}/main
+# 每个进程使用自己的检查点，否则会互相覆盖，恢复时还会删除其他进程的run文件
+/usr/local/bin/mpiexec -np 4 -machinefile $PBS_NODEFILE \
+    sh -c "/home/${USER}/main -c /home/${USER}/checkpoint/ckpt.\${PMI_RANK:-\$OMPI_COMM_WORLD_RANK}"
 
 scp -r /home/${USER}/files/ master_ubss1:/home/${USER}/guess/ 2>&1
+# 整个目录替换，已经不再引用的run文件不会留在master_ubss1上
+scp -r /home/${USER}/checkpoint master_ubss1:/home/${USER}/guess/checkpoint.new 2>&1 &&
+    ssh master_ubss1 "rm -rf /home/${USER}/guess/checkpoint && mv /home/${USER}/guess/checkpoint.new /home/${USER}/guess/checkpoint" 2>&1
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// push/pop等待时先让出CPU这么多次，仍然不能继续就睡眠在条件变量上，由另一方唤醒
+#define RING_BUFFER_SPIN 64
+
+/**
+ * RingBuffer: 容量固定的无锁环形队列，允许多个线程同时push和pop
+ * 每个格子带一个序号：序号等于pos时，这个格子可以写入第pos个元素；等于pos + 1时，可以读出第pos个元素
+ * 写入方和读出方各自用CAS抢占一个位置，之后只访问自己抢到的格子，不需要加锁
+ * 队列满时push等待，从而限制生产者最多领先消费者capacity个元素（背压）
+ * 等待时先短暂地自旋，等待较久（例如哈希线程没有批可做）时睡眠，不占用CPU
+ */
+template <class T>
+class RingBuffer
+{
+public:
+    // capacity必须是2的幂
+    explicit RingBuffer(size_t capacity) : cells(capacity), mask(capacity - 1)
+    {
+        for (size_t i = 0; i < capacity; i += 1)
+        {
+            cells[i].seq.store(i, memory_order_relaxed);
+        }
+    }
+
+    // 队列满时返回false，value不变
+    bool try_push(T &value)
+    {
+        if (!put(value))
+        {
+            return false;
+        }
+        wake();
+        return true;
+    }
+
+    // 队列空时返回false
+    bool try_pop(T &value)
+    {
+        if (!take(value))
+        {
+            return false;
+        }
+        wake();
+        return true;
+    }
+
+    // 等到有空位再放入
+    void push(T &value)
+    {
+        for (int spin = 0; spin < RING_BUFFER_SPIN; spin += 1)
+        {
+            if (try_push(value))
+            {
+                return;
+            }
+            this_thread::yield();
+        }
+        sleep_until([&]() { return put(value); });
+        wake();
+    }
+
+    // 等到有元素再取出；队列已经close并且取空之后返回false
+    bool pop(T &value)
+    {
+        for (int spin = 0; spin < RING_BUFFER_SPIN; spin += 1)
+        {
+            if (try_pop(value))
+            {
+                return true;
+            }
+            if (closed.load(memory_order_acquire))
+            {
+                // close之前放入的元素可能刚好在上一次try_pop之后才可见，再取一次
+                return try_pop(value);
+            }
+            this_thread::yield();
+        }
+        bool got = false;
+        sleep_until([&]() { return (got = take(value)) || closed.load(memory_order_acquire); });
+        if (got)
+        {
+            wake();
+            return true;
+        }
+        return try_pop(value);
+    }
+
+    // 生产者不再放入新的元素，消费者取空队列之后pop返回false
+    void close()
+    {
+        closed.store(true, memory_order_release);
+        lock_guard<mutex> lock(sleep_mutex);
+        changed.notify_all();
+    }
+
+private:
+    // try_push和try_pop的无锁部分，不唤醒睡眠的线程
+    bool put(T &value)
+    {
+        size_t pos = tail.load(memory_order_relaxed);
+        while (true)
+        {
+            Cell &cell = cells[pos & mask];
+            size_t seq = cell.seq.load(memory_order_acquire);
+            long diff = (long)seq - (long)pos;
+            if (diff == 0)
+            {
+                if (tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                {
+                    cell.value = std::move(value);
+                    cell.seq.store(pos + 1, memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = tail.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    bool take(T &value)
+    {
+        size_t pos = head.load(memory_order_relaxed);
+        while (true)
+        {
+            Cell &cell = cells[pos & mask];
+            size_t seq = cell.seq.load(memory_order_acquire);
+            long diff = (long)seq - (long)(pos + 1);
+            if (diff == 0)
+            {
+                if (head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                {
+                    value = std::move(cell.value);
+                    cell.seq.store(pos + mask + 1, memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = head.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    // 睡眠直到ready()返回true。ready在持有sleep_mutex时检查，wake在sleepers不为0时加锁再唤醒：
+    // 两边都在修改之后、检查对方之前插入seq_cst的fence，所以不会出现一方刚好错过另一方的唤醒而一直睡下去
+    template <class Ready>
+    void sleep_until(Ready ready)
+    {
+        sleepers.fetch_add(1, memory_order_seq_cst);
+        atomic_thread_fence(memory_order_seq_cst);
+        unique_lock<mutex> lock(sleep_mutex);
+        while (!ready())
+        {
+            changed.wait(lock);
+        }
+        sleepers.fetch_sub(1, memory_order_relaxed);
+    }
+
+    // 一次push或pop成功之后调用（不能持有sleep_mutex），唤醒等待的另一方。没有线程在睡眠时只有一个fence的开销
+    void wake()
+    {
+        atomic_thread_fence(memory_order_seq_cst);
+        if (sleepers.load(memory_order_relaxed) > 0)
+        {
+            lock_guard<mutex> lock(sleep_mutex);
+            changed.notify_all();
+        }
+    }
+
+    struct Cell
+    {
+        atomic<size_t> seq;
+        T value;
+    };
+    vector<Cell> cells;
+    size_t mask;
+    // head和tail分别被消费者和生产者频繁修改，放在不同的cache line上
+    alignas(64) atomic<size_t> head{0};
+    alignas(64) atomic<size_t> tail{0};
+    atomic<bool> closed{false};
+    atomic<int> sleepers{0};
+    mutex sleep_mutex;
+    condition_variable changed;
+};
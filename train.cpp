@@ -41,12 +41,16 @@ void model::train(string path)
         // 读取单个口令之后，就可以将其扔进parse函数进行PT/segment的分割、识别、统计了
         parse(pw);
     }
+    if (skipped_passwords > 0)
+    {
+        cout << "Passwords skipped (more than " << PT_MAX_SEGMENTS << " segments): " << skipped_passwords << endl;
+    }
 }
 
 /// @brief 在模型中找到一个PT的统计数据
 /// @param pt 需要查找的PT
 /// @return 目标PT在模型中的对应下标
-int model::FindPT(PT pt)
+int model::FindPT(const PT &pt)
 {
     for (int id = 0; id < preterminals.size(); id += 1)
     {
@@ -74,51 +78,9 @@ int model::FindPT(PT pt)
     return -1;
 }
 
-/// @brief 在模型中找到一个letter segment的统计数据
-/// @param seg 要找的letter segment
-/// @return 目标letter segment的对应下标
-int model::FindLetter(segment seg)
-{
-    for (int id = 0; id < letters.size(); id += 1)
-    {
-        if (letters[id].length == seg.length)
-        {
-            return id;
-        }
-    }
-    return -1;
-}
-
-/// @brief 在模型中找到一个digit segment的统计数据
-/// @param seg 要找的digit segment
-/// @return 目标digit segment的对应下标
-int model::FindDigit(segment seg)
-{
-    for (int id = 0; id < digits.size(); id += 1)
-    {
-        if (digits[id].length == seg.length)
-        {
-            return id;
-        }
-    }
-    return -1;
-}
-
-int model::FindSymbol(segment seg)
-{
-    for (int id = 0; id < symbols.size(); id += 1)
-    {
-        if (symbols[id].length == seg.length)
-        {
-            return id;
-        }
-    }
-    return -1;
-}
-
-void PT::insert(segment seg)
+void PT::insert(int type, int length)
 {
-    content.emplace_back(seg);
+    content.emplace_back({(short)type, (short)length});
 }
 
 void segment::insert(string value)
@@ -159,10 +121,50 @@ void segment::order()
         ordered_freqs.emplace_back(freqs.at(values[val]));
         total_freq += freqs.at(values[val]);
     }
+    // 每个value概率的对数，生成猜测时PT的概率只需要加减这些值
+    for (int i = 0; i < ordered_values.size(); i += 1)
+    {
+        log_probs.emplace_back(LogProb(double(ordered_freqs[i]) / total_freq));
+    }
+}
+
+void model::AddSegment(PT &pt, int type, string &value)
+{
+    int length = value.length();
+    while (segments[type].size() <= length)
+    {
+        segments[type].emplace_back(type, segments[type].size());
+        segment_freq[type].emplace_back(0);
+    }
+    segments[type][length].insert(value);
+    segment_freq[type][length] += 1;
+    pt.insert(type, length);
+    value.clear();
+}
+
+// 0: 未设置, 1: 字母, 2: 数字, 3: 特殊字符
+static int CharType(char ch)
+{
+    return isalpha(ch) ? 1 : (isdigit(ch) ? 2 : 3);
 }
 
 void model::parse(string pw)
 {
+    // segment数超过PT_MAX_SEGMENTS的口令放不进PT，在统计任何数据之前直接跳过
+    int n_segments = 0;
+    for (int i = 0; i < pw.length(); i += 1)
+    {
+        if (i == 0 || CharType(pw[i]) != CharType(pw[i - 1]))
+        {
+            n_segments += 1;
+        }
+    }
+    if (n_segments > PT_MAX_SEGMENTS)
+    {
+        skipped_passwords += 1;
+        return;
+    }
+
     PT pt;
     string curr_part = "";
     int curr_type = 0; // 0: 未设置, 1: 字母, 2: 数字, 3: 特殊字符
@@ -170,204 +172,18 @@ void model::parse(string pw)
     // 相信我，以后你会用上的。You're welcome :)
     for (char ch : pw)
     {
-        if (isalpha(ch))
-        {
-            if (curr_type != 1)
-            {
-                if (curr_type == 2)
-                {
-                    segment seg(curr_type, curr_part.length());
-                    if (FindDigit(seg) == -1)
-                    {
-                        int id = GetNextDigitsID();
-                        digits.emplace_back(seg);
-                        digits[id].insert(curr_part);
-                        digits_freq[id] = 1;
-                    }
-                    else
-                    {
-                        int id = FindDigit(seg);
-                        digits_freq[id] += 1;
-                        digits[id].insert(curr_part);
-                    }
-                    curr_part.clear();
-                    pt.insert(seg);
-                }
-                else if (curr_type == 3)
-                {
-                    segment seg(curr_type, curr_part.length());
-                    if (FindSymbol(seg) == -1)
-                    {
-                        int id = GetNextSymbolsID();
-                        symbols.emplace_back(seg);
-                        symbols_freq[id] = 1;
-                        symbols[id].insert(curr_part);
-                    }
-                    else
-                    {
-                        int id = FindSymbol(seg);
-                        symbols_freq[id] += 1;
-                        symbols[id].insert(curr_part);
-                    }
-                    curr_part.clear();
-                    pt.insert(seg);
-                }
-            }
-            curr_type = 1;
-            curr_part += ch;
-        }
-        else if (isdigit(ch))
-        {
-            if (curr_type != 2)
-            {
-                if (curr_type == 1)
-                {
-                    segment seg(curr_type, curr_part.length());
-                    if (FindLetter(seg) == -1)
-                    {
-                        int id = GetNextLettersID();
-                        letters.emplace_back(seg);
-                        letters_freq[id] = 1;
-                        letters[id].insert(curr_part);
-                    }
-                    else
-                    {
-                        int id = FindLetter(seg);
-                        letters_freq[id] += 1;
-                        letters[id].insert(curr_part);
-                    }
-                    curr_part.clear();
-                    pt.insert(seg);
-                }
-                else if (curr_type == 3)
-                {
-                    segment seg(curr_type, curr_part.length());
-                    if (FindSymbol(seg) == -1)
-                    {
-                        int id = GetNextSymbolsID();
-                        symbols.emplace_back(seg);
-                        symbols_freq[id] = 1;
-                        symbols[id].insert(curr_part);
-                    }
-                    else
-                    {
-                        int id = FindSymbol(seg);
-                        symbols_freq[id] += 1;
-                        symbols[id].insert(curr_part);
-                    }
-                    curr_part.clear();
-                    pt.insert(seg);
-                }
-            }
-            curr_type = 2;
-            curr_part += ch;
-        }
-        else
+        int type = CharType(ch);
+        // 字符的类型发生变化时，前面的一段就是一个完整的segment
+        if (curr_type != 0 && type != curr_type)
         {
-            if (curr_type != 3)
-            {
-                if (curr_type == 1)
-                {
-                    segment seg(curr_type, curr_part.length());
-                    if (FindLetter(seg) == -1)
-                    {
-                        int id = GetNextLettersID();
-                        letters.emplace_back(seg);
-                        letters_freq[id] = 1;
-                        letters[id].insert(curr_part);
-                    }
-                    else
-                    {
-                        int id = FindLetter(seg);
-                        letters_freq[id] += 1;
-                        letters[id].insert(curr_part);
-                    }
-                    curr_part.clear();
-                    pt.insert(seg);
-                }
-                else if (curr_type == 2)
-                {
-                    segment seg(curr_type, curr_part.length());
-                    if (FindDigit(seg) == -1)
-                    {
-                        int id = GetNextDigitsID();
-                        digits.emplace_back(seg);
-                        digits_freq[id] = 1;
-                        digits[id].insert(curr_part);
-                    }
-                    else
-                    {
-                        int id = FindDigit(seg);
-                        digits_freq[id] += 1;
-                        digits[id].insert(curr_part);
-                    }
-                    curr_part.clear();
-                    pt.insert(seg);
-                }
-            }
-            curr_type = 3;
-            curr_part += ch;
+            AddSegment(pt, curr_type, curr_part);
         }
+        curr_type = type;
+        curr_part += ch;
     }
     if (!curr_part.empty())
     {
-        if (curr_type == 1)
-        {
-            segment seg(curr_type, curr_part.length());
-            if (FindLetter(seg) == -1)
-            {
-                int id = GetNextLettersID();
-                letters.emplace_back(seg);
-                letters_freq[id] = 1;
-                letters[id].insert(curr_part);
-            }
-            else
-            {
-                int id = FindLetter(seg);
-                letters_freq[id] += 1;
-                letters[id].insert(curr_part);
-            }
-            curr_part.clear();
-            pt.insert(seg);
-        }
-        else if (curr_type == 2)
-        {
-            segment seg(curr_type, curr_part.length());
-            if (FindDigit(seg) == -1)
-            {
-                int id = GetNextDigitsID();
-                digits.emplace_back(seg);
-                digits_freq[id] = 1;
-                digits[id].insert(curr_part);
-            }
-            else
-            {
-                int id = FindDigit(seg);
-                digits_freq[id] += 1;
-                digits[id].insert(curr_part);
-            }
-            curr_part.clear();
-            pt.insert(seg);
-        }
-        else
-        {
-            segment seg(curr_type, curr_part.length());
-            if (FindSymbol(seg) == -1)
-            {
-                int id = GetNextSymbolsID();
-                symbols.emplace_back(seg);
-                symbols_freq[id] = 1;
-                symbols[id].insert(curr_part);
-            }
-            else
-            {
-                int id = FindSymbol(seg);
-                symbols_freq[id] += 1;
-                symbols[id].insert(curr_part);
-            }
-            curr_part.clear();
-            pt.insert(seg);
-        }
+        AddSegment(pt, curr_type, curr_part);
     }
     // pt.PrintPT();
     // cout<<endl;
@@ -393,6 +209,11 @@ void model::parse(string pw)
 }
 
 void segment::PrintSeg()
+{
+    PTSegment{(short)type, (short)length}.PrintSeg();
+}
+
+void PTSegment::PrintSeg() const
 {
     if (type == 1)
     {
@@ -439,30 +260,23 @@ void model::print()
     for (auto iter : ordered_pts)
     {
         iter.PrintPT();
-        cout << " freq:" << preterm_freq[FindPT(iter)];
+        cout << " freq:" << preterm_freq[iter.model_index];
         cout << endl;
     }
     cout << "segments:" << endl;
-    for (int i = 0; i < letters.size(); i += 1)
-    {
-        letters[i].PrintSeg();
-        // letters[i].PrintValues();
-        cout << " freq:" << letters_freq[i];
-        cout << endl;
-    }
-    for (int i = 0; i < digits.size(); i += 1)
+    for (int type = 1; type <= 3; type += 1)
     {
-        digits[i].PrintSeg();
-        // digits[i].PrintValues();
-        cout << " freq:" << digits_freq[i];
-        cout << endl;
-    }
-    for (int i = 0; i < symbols.size(); i += 1)
-    {
-        symbols[i].PrintSeg();
-        // symbols[i].PrintValues();
-        cout << " freq:" << symbols_freq[i];
-        cout << endl;
+        for (int length = 0; length < segments[type].size(); length += 1)
+        {
+            if (segment_freq[type][length] == 0)
+            {
+                continue;
+            }
+            segments[type][length].PrintSeg();
+            // segments[type][length].PrintValues();
+            cout << " freq:" << segment_freq[type][length];
+            cout << endl;
+        }
     }
 }
 
@@ -473,31 +287,56 @@ bool compareByPretermProb(const PT& a, const PT& b) {
 void model::order()
 {
     cout << "Training phase 2: Ordering segment values and PTs..." << endl;
-    for (PT pt : preterminals)
+    for (int id = 0; id < preterminals.size(); id += 1)
     {
-        pt.preterm_prob = float(preterm_freq[FindPT(pt)]) / total_preterm;
+        // 在这里一次性确定PT在模型中的下标，之后生成猜测时不再需要FindPT
+        PT pt = preterminals[id];
+        pt.model_index = id;
+        pt.preterm_prob = float(preterm_freq[id]) / total_preterm;
         ordered_pts.emplace_back(pt);
     }
     bool swapped;
     cout << "total pts" << ordered_pts.size() << endl;
     std::sort(ordered_pts.begin(), ordered_pts.end(), compareByPretermProb);
     cout << "Ordering letters" << endl;
-    // cout << "total letters" << endl;
-    for (int i = 0; i < letters.size(); i += 1)
+    for (segment &seg : segments[1])
     {
-        // cout << i << endl;
-        letters[i].order();
+        seg.order();
     }
     cout << "Ordering digits" << endl;
-    // cout << "total letters" << endl;
-    for (int i = 0; i < digits.size(); i += 1)
+    for (segment &seg : segments[2])
     {
-        digits[i].order();
+        seg.order();
     }
     cout << "ordering symbols" << endl;
-    // cout << "total letters" << endl;
-    for (int i = 0; i < symbols.size(); i += 1)
+    for (segment &seg : segments[3])
+    {
+        seg.order();
+    }
+
+    // 训练结果的指纹，用于检查检查点是否来自同一个模型
+    fingerprint = 14695981039346656037ULL;
+    auto mix = [this](const void *data, size_t n)
+    {
+        for (size_t i = 0; i < n; i += 1)
+        {
+            fingerprint = (fingerprint ^ ((const unsigned char *)data)[i]) * 1099511628211ULL;
+        }
+    };
+    for (const PT &pt : ordered_pts)
+    {
+        mix(pt.content.begin(), pt.content.size() * sizeof(PTSegment));
+        mix(&preterm_freq[pt.model_index], sizeof(int));
+    }
+    for (int type = 1; type <= 3; type += 1)
     {
-        symbols[i].order();
+        for (const segment &seg : segments[type])
+        {
+            for (int i = 0; i < seg.ordered_values.size(); i += 1)
+            {
+                mix(seg.ordered_values[i].data(), seg.ordered_values[i].size() + 1);
+                mix(&seg.ordered_freqs[i], sizeof(int));
+            }
+        }
     }
 }
\ No newline at end of file